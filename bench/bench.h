@@ -0,0 +1,113 @@
+// NOTE: Each benchmark includes this, which builds main.c's functions into it (main itself becomes aether_main).
+// memmove is counted, since moving bytes is what most edits cost on the calculator.
+// BENCH_MAIN_C can name an older main.c to compare with, see the makefile.
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+long bench_moved_bytes = 0;
+static inline void *bench_memmove(void *dest, const void *src, size_t count) {
+    bench_moved_bytes += (long)count;
+    return memmove(dest, src, count);
+}
+// NOTE: The heap is counted too, for the most it ever held. If bench_heap_limit isn't 0, it's all the heap there is.
+long bench_heap_bytes = 0;
+long bench_peak_heap_bytes = 0;
+long bench_heap_limit = 0;
+static inline void *bench_malloc(size_t size) {
+    if(bench_heap_limit && bench_heap_bytes + (long)size > bench_heap_limit) { return NULL; }
+    size_t *block = malloc(sizeof(size_t) + size);
+    block[0] = size;
+    bench_heap_bytes += (long)size;
+    if(bench_heap_bytes > bench_peak_heap_bytes) { bench_peak_heap_bytes = bench_heap_bytes; }
+    return block + 1;
+}
+static inline void bench_free(void *pointer) {
+    if(pointer) {
+        size_t *block = (size_t*)pointer - 1;
+        bench_heap_bytes -= (long)block[0];
+        free(block);
+    }
+}
+#define memmove bench_memmove
+#define malloc bench_malloc
+#define free bench_free
+#define main aether_main
+#ifndef BENCH_MAIN_C
+    #define BENCH_MAIN_C "../src/main.c"
+#endif
+#include BENCH_MAIN_C
+#undef main
+#undef memmove
+#undef malloc
+#undef free
+
+extern long host_token_string_calls;
+extern long host_written_bytes;
+extern long host_blit_bytes;
+extern long host_glyphs;
+extern long host_garbage_collects;
+extern int host_noclip_violations;
+extern bool host_archiving_collects;
+int host_create(const char *name, uint8_t type, const void *data, int size);
+int host_var_size(const char *name, uint8_t type);
+const uint8_t *host_var_data(const char *name, uint8_t type);
+
+static inline double bench_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1e9 + now.tv_nsec;
+}
+
+// NOTE: What main() does before its loop, minus the catalog
+void bench_start_editor(void) {
+    initialize_graphics();
+    ti_SetGCBehavior(gc_before, gc_after);
+    fontlib_SetFont(editor_font, 0);
+#ifndef BENCH_BEFORE_GLYPH_ATLAS
+    build_glyph_atlas();
+    build_token_string_cache();
+#endif
+    update_editor_theme_based_on_settings();
+    editor.running = true;
+}
+
+// NOTE: Lines of 8 to 40 bytes of letters, spaces and two byte tokens, with a Lbl line every labels_every lines
+// (none if 0). Labels are named with two letters, AA, AB, ..., in program order.
+s24 bench_make_program(const char *name, s24 size, s24 labels_every) {
+    static u8 data[70000];
+    s24 at = 0;
+    s24 line = 0;
+    s24 labels = 0;
+    srand(1);
+    while(at < size - 48) {
+        if(labels_every && line % labels_every == 0) {
+            data[at++] = LBL;
+            data[at++] = cast(u8)('A' + (labels/26) % 26);
+            data[at++] = cast(u8)('A' + labels % 26);
+            labels += 1;
+        } else {
+            s24 length = 8 + rand() % 33;
+            for(s24 i = 0; i < length; ++i) {
+                s24 kind = rand() % 10;
+                if(kind < 2) {
+                    data[at++] = SPACE;
+                } else if(kind < 3) {
+                    data[at++] = 0xBB;
+                    data[at++] = cast(u8)(0x40 + rand() % 0x30);
+                    i += 1;
+                } else {
+                    data[at++] = cast(u8)('A' + rand() % 26);
+                }
+            }
+        }
+        data[at++] = LINEBREAK;
+        line += 1;
+    }
+    while(at < size) {
+        data[at++] = 'Z';
+    }
+    host_create(name, OS_TYPE_PRGM, data, size);
+    return labels;
+}
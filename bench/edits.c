@@ -0,0 +1,627 @@
+// NOTE: Not a benchmark but a check: thousands of random edits to a program, each one also made to a copy here,
+// and after each the program, its linebreaks, line blocks, checkpoints, labels, indentation and search are checked
+// against the copy or against walking the program. Edits are typing, removing, bursts of keys at one place
+// (so undo steps merge), undo then redo, and replace all. Saves go between them: whole saves, saves a slice
+// at a time with edits in between the slices, or, in a windowed program, saves with big pastes and removes that
+// make the window move. At the end, everything is undone, paged back in from the undo journal, and redone,
+// and the journal has to survive loading the program again but not the program changing.
+// Each run prints its failures, and the exit status is how many runs failed.
+#include "bench.h"
+
+typedef enum SaveMode {
+    SaveMode_Whole,
+    SaveMode_Sliced,
+    SaveMode_Windowed,
+} SaveMode;
+
+static u8 reference[140000];
+static s24 reference_size;
+static int failures;
+static bool long_lines;
+
+#define CHECK(condition, ...) do { \
+    if(!(condition)) { \
+        failures += 1; \
+        if(failures <= 10) { fprintf(stderr, "edits.c:%d: ", __LINE__); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } \
+    } \
+} while(0)
+
+// NOTE: The same first bytes as host.c's ti_GetTokenString, so the copy splits tokens without asking main.c
+static const u8 two_byte_prefixes[] = {0x5C, 0x5D, 0x5E, 0x60, 0x61, 0x62, 0x63, 0x7E, 0xAA, 0xBB, 0xEF};
+
+s24 reference_token_size(s24 at) {
+    for(u24 i = 0; i < ARRLEN(two_byte_prefixes); ++i) {
+        if(reference[at] == two_byte_prefixes[i]) { return 2; }
+    }
+    return 1;
+}
+
+// NOTE: Second bytes start at 0x3F, so some are the same byte as a linebreak, like 2-PropZTest( (0xBB 0x3F)
+s24 random_token(u8 *out) {
+    s24 kind = rand() % 20;
+    s24 result = 1;
+    if(kind < 3 && (!long_lines || rand() % 60 == 0)) {
+        out[0] = LINEBREAK;
+    } else if(kind < 6) {
+        out[0] = two_byte_prefixes[rand() % ARRLEN(two_byte_prefixes)];
+        out[1] = cast(u8)(0x3F + rand() % 0x30);
+        result = 2;
+    } else if(kind < 8) {
+        out[0] = SPACE;
+    } else if(kind < 9) {
+        // NOTE: If, Then, While, End and Lbl
+        u8 blocks[] = {0xCE, 0xCF, 0xD1, 0xD4, LBL};
+        out[0] = blocks[rand() % 5];
+    } else {
+        out[0] = cast(u8)('A' + rand() % 26);
+    }
+    return result;
+}
+
+s24 random_tokens(u8 *out, s24 count) {
+    s24 result = 0;
+    for(s24 i = 0; i < count; ++i) {
+        result += random_token(out + result);
+    }
+    return result;
+}
+
+s24 random_reference_boundary(void) {
+    s24 target = rand() % (reference_size + 1);
+    s24 at = 0;
+    while(at < target) {
+        at += reference_token_size(at);
+    }
+    return min(at, reference_size);
+}
+
+// NOTE: Past 65505 bytes the editor leaves the program alone and says so
+bool insert_into_both(s24 at, u8 *tokens, s24 count) {
+    program.notice = null;
+    insert_tokens(at, tokens, cast(u16)count);
+    bool result = program.notice == null;
+    if(result) {
+        memmove(reference + at + count, reference + at, cast(size_t)(reference_size - at));
+        memcpy(reference + at, tokens, cast(size_t)count);
+        reference_size += count;
+    }
+    program.notice = null;
+    return result;
+}
+
+void remove_from_reference(s24 at, s24 count) {
+    memmove(reference + at, reference + at + count, cast(size_t)(reference_size - at - count));
+    reference_size -= count;
+}
+
+void reference_from_program(void) {
+    reference_size = program.size;
+    for(s24 i = 0; i < reference_size; ++i) {
+        reference[i] = get_program_byte(i);
+    }
+}
+
+u32 hash_program(void) {
+    u32 result = 2166136261;
+    for(s24 i = 0; i < program.size; ++i) {
+        result = (result ^ get_program_byte(i)) * 16777619;
+    }
+    return result ^ cast(u32)program.size;
+}
+
+// ---- Checks against the copy, or against walking the program
+
+void check_program(char *when) {
+    CHECK(program.size == reference_size, "%s: size %d, should be %d", when, program.size, reference_size);
+    for(s24 i = 0; i < min(program.size, reference_size); ++i) {
+        if(get_program_byte(i) != reference[i]) {
+            CHECK(false, "%s: byte %d differs", when, i);
+            break;
+        }
+    }
+    // NOTE: Only linebreaks where tokens start are lines
+    s24 line = 1;
+    bool lines_match = true;
+    for(s24 i = 0; i < reference_size && lines_match; i += reference_token_size(i)) {
+        if(reference[i] == LINEBREAK) {
+            lines_match = line < program.linebreaks_count && get_linebreak_location(line) == i;
+            CHECK(lines_match, "%s: linebreak %d should be at %d", when, line, i);
+            line += 1;
+        }
+    }
+    if(lines_match) {
+        CHECK(line == program.linebreaks_count, "%s: %d lines, should be %d", when, program.linebreaks_count, line);
+    }
+}
+
+s24 walked_line_of(s24 offset) {
+    s24 result = program.linebreaks_count - 1;
+    for(s24 line = 0; line <= program.linebreaks_count - 1; ++line) {
+        if(offset <= get_linebreak_location(line)) {
+            result = line - 1;
+            break;
+        }
+    }
+    return result;
+}
+
+s24 walked_width(s24 start, s24 end) {
+    s24 result = 0;
+    for(s24 at = start; at < end; at += get_token_size(at)) {
+        result += get_token_width(at);
+    }
+    return result;
+}
+
+void check_line_index(char *when) {
+    for(s24 k = 0; k < 5; ++k) {
+        s24 offset = rand() % (program.size + 1);
+        CHECK(calculate_line_y(offset) == walked_line_of(offset), "%s: line of %d is %d, should be %d", when, offset,
+              calculate_line_y(offset), walked_line_of(offset));
+        program.cursor = rand() % 2 ? offset : min(program.size, max(0, program.cursor + rand() % 40 - 20));
+        CHECK(calculate_cursor_y() == walked_line_of(program.cursor), "%s: cursor line of %d", when, program.cursor);
+    }
+    for(s24 c = 1; c <= program.line_checkpoints_count - 1; ++c) {
+        CHECK(program.line_checkpoints[c - 1].offset < program.line_checkpoints[c].offset, "%s: checkpoints out of order", when);
+    }
+    for(s24 k = 0; k < 5 && program.line_checkpoints_count > 0; ++k) {
+        s24 c = rand() % program.line_checkpoints_count;
+        s24 offset = program.line_checkpoints[c].offset;
+        s24 line = calculate_line_y(offset);
+        CHECK(line >= 0 && offset < get_line_end(line), "%s: checkpoint %d at %d is past its line", when, c, offset);
+        if(line >= 0) {
+            s24 width = walked_width(get_linebreak_location(line) + 1, offset);
+            CHECK(program.line_checkpoints[c].column == width, "%s: checkpoint %d column %d, should be %d", when, c,
+                  program.line_checkpoints[c].column, width);
+        }
+    }
+    for(s24 line = 0; line <= program.linebreaks_count - 1; ++line) {
+        if(get_linebreak(line)->width != LINE_WIDTH_UNKNOWN) {
+            s24 width = walked_width(get_linebreak_location(line) + 1, get_line_end(line));
+            CHECK(get_linebreak(line)->width == width, "%s: line %d width %d, should be %d", when, line, get_linebreak(line)->width, width);
+        }
+    }
+    for(s24 k = 0; k < 5; ++k) {
+        s24 line = rand() % program.linebreaks_count;
+        s24 start = get_linebreak_location(line) + 1;
+        s24 end = get_line_end(line);
+        s24 target = start + (end > start ? rand() % (end - start + 1) : 0);
+        s24 offset = start;
+        while(offset < target) {
+            offset += get_token_size(offset);
+        }
+        offset = min(offset, end);
+        CHECK(get_column_of_offset(line, offset) == walked_width(start, offset), "%s: column of %d in line %d", when, offset, line);
+        s24 column_target = rand() % (walked_width(start, end) + 1);
+        s24 column;
+        s24 found = find_column_in_line(line, column_target, &column);
+        CHECK(column <= column_target && column == walked_width(start, found), "%s: column %d in line %d", when, column_target, line);
+    }
+}
+
+void check_line_blocks(char *when) {
+    s24 line = 0;
+    for(s24 b = 0; b <= program.line_blocks_count - 1; ++b) {
+        LineBlock *block = &program.line_blocks[b];
+        CHECK(block->first_line == line && block->count >= 1 && block->count <= LINE_BLOCK_LINES,
+              "%s: block %d starts at line %d with %d lines, should start at %d", when, b, block->first_line, block->count, line);
+        CHECK(b == 0 || block->lines[0].location_ == 0, "%s: block %d doesn't start at its base", when, b);
+        line += block->count;
+    }
+    CHECK(line == program.linebreaks_count, "%s: blocks hold %d lines of %d", when, line, program.linebreaks_count);
+}
+
+void check_labels(char *when) {
+    if(program.fully_indexed) {
+        s24 count = 0;
+        for(s24 at = 0; at < program.size; at += get_token_size(at)) {
+            if(get_program_byte(at) == LBL) {
+                if(count < LABELS_MAX && !program.labels_overflowed) {
+                    CHECK(count < program.labels_count && program.labels[count] == at, "%s: label %d should be at %d", when, count, at);
+                }
+                count += 1;
+            }
+        }
+        CHECK(program.labels_overflowed || count == program.labels_count, "%s: %d labels, should be %d", when, program.labels_count, count);
+        for(s24 k = 0; k < 3; ++k) {
+            u16 name = rand() % 3 ? cast(u16)('A' + rand() % 3) : cast(u16)(('A' + rand() % 3) << 8 | ('0' + rand() % 3));
+            s24 walked = -1;
+            for(s24 at = 0; at < program.size; at += get_token_size(at)) {
+                if(get_program_byte(at) == LBL && get_label_name(at) == name) {
+                    walked = at;
+                    break;
+                }
+            }
+            CHECK(find_label_named(name) == walked, "%s: Lbl %x at %d, should be %d", when, name, find_label_named(name), walked);
+        }
+    }
+}
+
+void update_walked_indentation(s24 *indentation, u8 token) {
+    // NOTE: If/Then, While, Repeat and For open a block, End closes one
+    if(token == 0xCF || (token >= 0xD1 && token <= 0xD3)) {
+        *indentation += 1;
+    } else if(token == 0xD4) {
+        *indentation = max(0, *indentation - 1);
+    }
+}
+
+void check_indentation(char *when) {
+    if(program.fully_indexed) {
+        s24 indentation = 0;
+        for(s24 line = 0; line <= program.linebreaks_count - 1; ++line) {
+            if(line % 7 == 0 || line == program.linebreaks_count - 1) {
+                CHECK(get_line_indentation(line) == indentation, "%s: line %d indented %d, should be %d", when, line,
+                      get_line_indentation(line), indentation);
+            }
+            s24 first = get_linebreak_location(line) + 1;
+            s24 last = (line + 1 <= program.linebreaks_count - 1) ? get_linebreak_location(line + 1) - 1 : program.size - 1;
+            if(first <= last) {
+                update_walked_indentation(&indentation, get_program_byte(first));
+                if(last != first) {
+                    update_walked_indentation(&indentation, get_program_byte(last));
+                }
+            }
+        }
+    }
+}
+
+void check_token_steps(char *when) {
+    if(program.fully_indexed && program.size > 0) {
+        for(s24 k = 0; k < 5; ++k) {
+            s24 target = rand() % program.size;
+            s24 at = 0;
+            while(at + get_token_size(at) <= target) {
+                at += get_token_size(at);
+            }
+            s24 next = at + get_token_size(at);
+            if(next <= program.size) {
+                CHECK(get_previous_token_start(next) == at, "%s: token before %d at %d, should be %d", when, next,
+                      get_previous_token_start(next), at);
+            }
+        }
+    }
+}
+
+void check_search(char *when) {
+    if(program.fully_indexed && program.size > 0) {
+        s24 target = rand() % program.size;
+        s24 at = 0;
+        while(at + get_token_size(at) <= target) {
+            at += get_token_size(at);
+        }
+        set_search_tokens(at, 1 + rand() % 4);
+        for(s24 k = 0; k < 3 && program.search_size > 0; ++k) {
+            s24 from = rand() % (program.size + 1);
+            s24 forward = -1;
+            s24 backward = -1;
+            for(s24 i = 0; i < program.size; i += get_token_size(i)) {
+                if(search_matches_at(i)) {
+                    if(i >= from && forward == -1) { forward = i; }
+                    if(i <= from) { backward = i; }
+                }
+            }
+            CHECK(search_forward(from, program.size) == forward, "%s: next match from %d is %d, should be %d", when, from,
+                  search_forward(from, program.size), forward);
+            CHECK(search_backward(0, from) == backward, "%s: previous match from %d is %d, should be %d", when, from,
+                  search_backward(0, from), backward);
+        }
+        program.search_size = 0;
+    }
+}
+
+void check_everything(char *when) {
+    check_program(when);
+    check_line_index(when);
+    check_line_blocks(when);
+    check_labels(when);
+    check_indentation(when);
+    check_token_steps(when);
+    check_search(when);
+}
+
+void check_saved(char *name, char *when) {
+    const u8 *saved = host_var_data(name, OS_TYPE_PRGM);
+    s24 saved_size = host_var_size(name, OS_TYPE_PRGM);
+    CHECK(saved && saved_size == reference_size && memcmp(saved, reference, cast(size_t)reference_size) == 0,
+          "%s: saved program is %d bytes, should be %d", when, saved_size, reference_size);
+}
+
+// ---- The run
+
+static u32 hashes[8000];
+static s24 hashes_count;
+
+// NOTE: Every delta, in RAM or paged back in from the journal, has to go back exactly one edit
+s24 undo_everything(s24 top) {
+    s24 result = 0;
+    while(failures == 0) {
+        program.undo_merge_open = false;
+        if(program.undo_buffer.delta_count == 0) {
+            page_in_undo_journal();
+        }
+        Delta *undo = pop_delta(&program.undo_buffer);
+        if(!undo) {
+            break;
+        }
+        apply_delta_to_program(undo, &program.redo_buffer);
+        result += 1;
+        CHECK(top - result >= 0 && hash_program() == hashes[top - result], "undo %d isn't the program it was", result);
+    }
+    return result;
+}
+
+// NOTE: Replaces a token or two from the program with 0 to 3 random tokens from the clipboard
+s24 replace_random_matches(void) {
+    static u8 replaced[140000];
+    s24 at = random_reference_boundary();
+    if(at >= reference_size) {
+        at = 0;
+    }
+    s24 search_size = reference_token_size(at);
+    if(rand() % 2 && at + search_size < reference_size) {
+        search_size += reference_token_size(at + search_size);
+    }
+    set_search_tokens(at, search_size);
+    // NOTE: Linebreaks can't be searched for
+    if(program.search_size == 0) {
+        return 0;
+    }
+    u8 to[8];
+    s24 to_count = random_tokens(to, rand() % 4);
+    host_create(CLIPBOARD_APPVAR_NAME, OS_TYPE_APPVAR, to, to_count);
+
+    s24 replaced_size = 0;
+    s24 matches = 0;
+    for(s24 i = 0; i < reference_size;) {
+        if(i + program.search_size <= reference_size && memcmp(reference + i, program.search_tokens, cast(size_t)program.search_size) == 0) {
+            memcpy(replaced + replaced_size, to, cast(size_t)to_count);
+            replaced_size += to_count;
+            i += program.search_size;
+            matches += 1;
+        } else {
+            s24 size = reference_token_size(i);
+            memcpy(replaced + replaced_size, reference + i, cast(size_t)size);
+            replaced_size += size;
+            i += size;
+        }
+    }
+
+    u24 generation_was = program.edit_generation;
+    replace_all_matches();
+    if(program.edit_generation != generation_was) {
+        if(program.notice) {
+            // NOTE: Stopped partway, which the notice says. What it did replace is checked from here on.
+            reference_from_program();
+        } else {
+            memcpy(reference, replaced, cast(size_t)replaced_size);
+            reference_size = replaced_size;
+        }
+        hashes[hashes_count++] = hash_program();
+    } else {
+        matches = 0;
+    }
+    program.notice = null;
+    program.search_size = 0;
+    return matches;
+}
+
+void run_edits(char *name, SaveMode mode, bool long_lines_, s24 size, s24 steps, u32 seed) {
+    srand(seed);
+    long_lines = long_lines_;
+    failures = 0;
+    reference_size = 0;
+    while(reference_size < size) {
+        reference_size += random_token(reference + reference_size);
+    }
+    host_create(name, OS_TYPE_PRGM, reference, reference_size);
+    load_program(name);
+    // NOTE: The first screen is indexed on load and the rest a slice at a time
+    CHECK(program.fully_indexed || program.linebreaks_count - 1 > EDITOR_ROW_COUNT, "the first screen wasn't indexed");
+    require_full_index();
+    check_everything("load");
+
+    hashes_count = 0;
+    hashes[hashes_count++] = hash_program();
+    s24 type_at = 0;
+    s24 saves = 0;
+    s24 replaced = 0;
+    long written = 0;
+    bool windowed = program.windowed;
+    for(s24 step = 0; step < steps && failures == 0; ++step) {
+        s24 op = rand() % 12;
+        type_at = min(type_at, reference_size);
+        {
+            s24 at = 0;
+            while(at + reference_token_size(at) <= type_at) {
+                at += reference_token_size(at);
+            }
+            type_at = at;
+        }
+        u24 newest_was = program.undo_buffer.newest;
+        u24 deltas_were = program.undo_buffer.delta_count;
+        bool edited = true;
+        if(rand() % 30 == 0 && reference_size > 0) {
+            replaced += replace_random_matches();
+            edited = false;
+        } else if(op < 5) {
+            s24 at = random_reference_boundary();
+            u8 tokens[8];
+            s24 count = random_tokens(tokens, 1 + rand() % 3);
+            insert_into_both(at, tokens, count);
+            type_at = at;
+        } else if(op < 8) {
+            s24 at = random_reference_boundary();
+            s24 end = at;
+            for(s24 k = 1 + rand() % 4; k > 0 && end < reference_size; --k) {
+                end += reference_token_size(end);
+            }
+            if(end > at) {
+                remove_tokens(at, cast(u16)(end - at));
+                remove_from_reference(at, end - at);
+            }
+        } else if(op < 10) {
+            // NOTE: Undo then redo has to give back the program it started with
+            program.undo_merge_open = false;
+            program.notice = null;
+            Delta *undo = pop_delta(&program.undo_buffer);
+            if(undo) {
+                apply_delta_to_program(undo, &program.redo_buffer);
+                Delta *redo = pop_delta(&program.redo_buffer);
+                // NOTE: An undo bigger than the redo buffer has no redo, then the program stays undone
+                CHECK(redo || mode == SaveMode_Windowed, "step %d: no redo", step);
+                if(redo) {
+                    apply_delta_to_program(redo, &program.undo_buffer);
+                } else {
+                    reference_from_program();
+                    hashes_count = max(1, hashes_count - 1);
+                }
+            }
+            edited = false;
+        } else {
+            // NOTE: Keys at one place, so undo steps merge
+            s24 key = rand() % 3;
+            if(key == 0) {
+                u8 tokens[2];
+                s24 count = random_token(tokens);
+                if(insert_into_both(type_at, tokens, count)) {
+                    type_at += count;
+                }
+            } else if(key == 1 && type_at < reference_size) {
+                s24 count = reference_token_size(type_at);
+                remove_tokens(type_at, cast(u16)count);
+                remove_from_reference(type_at, count);
+            } else if(type_at > 0) {
+                s24 at = 0;
+                while(at + reference_token_size(at) < type_at) {
+                    at += reference_token_size(at);
+                }
+                remove_tokens(at, cast(u16)(type_at - at));
+                remove_from_reference(at, type_at - at);
+                type_at = at;
+            }
+        }
+        if(edited) {
+            bool merged = deltas_were > 0 && program.undo_buffer.newest == newest_was && program.undo_buffer.delta_count == deltas_were;
+            if(merged) {
+                hashes[hashes_count - 1] = hash_program();
+            } else {
+                hashes[hashes_count++] = hash_program();
+            }
+        }
+
+        if(mode == SaveMode_Whole && step % 7 == 0) {
+            long written_was = host_written_bytes;
+            save_program();
+            written += host_written_bytes - written_was;
+            saves += 1;
+            check_saved(name, "save");
+            written_was = host_written_bytes;
+            save_program();
+            CHECK(host_written_bytes == written_was, "step %d: saving an unchanged program wrote it again", step);
+        } else if(mode == SaveMode_Sliced) {
+            // NOTE: Like autosaving, a slice of up to 2000 bytes each step with the edits going on in between
+            if(!program.autosaving && step % 11 == 0 && program.saved_generation != program.edit_generation) {
+                program.autosaving = true;
+            } else if(program.autosaving) {
+                long written_was = host_written_bytes;
+                bool done = save_program_slice(1 + rand() % 2000);
+                written += host_written_bytes - written_was;
+                if(done) {
+                    program.autosaving = false;
+                    saves += 1;
+                    check_saved(name, "sliced save");
+                    CHECK(program.saved_generation == program.edit_generation, "step %d: sliced save wasn't marked saved", step);
+                }
+            }
+        } else if(mode == SaveMode_Windowed && step % 97 == 0) {
+            long written_was = host_written_bytes;
+            save_program();
+            written += host_written_bytes - written_was;
+            saves += 1;
+            check_saved(name, "windowed save");
+            // NOTE: A big paste or remove makes the window make room, then the cursor goes somewhere else
+            if(step % 2 == 0 && reference_size < 60000) {
+                static u8 pasted[20000];
+                s24 at = random_reference_boundary();
+                s24 count = 0;
+                for(s24 want = 2000 + rand() % 8000; count < want;) {
+                    count += random_token(pasted + count);
+                }
+                insert_into_both(at, pasted, count);
+            } else if(reference_size > 20000) {
+                s24 at = random_reference_boundary();
+                s24 end = at;
+                for(s24 want = 2000 + rand() % 18000; end < reference_size && end - at < want;) {
+                    end += reference_token_size(end);
+                }
+                remove_tokens(at, cast(u16)(end - at));
+                remove_from_reference(at, end - at);
+            }
+            hashes[hashes_count++] = hash_program();
+            program.cursor = random_reference_boundary();
+            keep_program_window_around_cursor();
+            windowed |= program.windowed;
+        }
+        check_everything("edit");
+    }
+
+    s24 undone = 0;
+    s24 redone = 0;
+    bool reloaded = false;
+    if(mode != SaveMode_Windowed && failures == 0) {
+        s24 top = hashes_count - 1;
+        // NOTE: The journal drops the oldest steps past UNDO_JOURNAL_MAX_SIZE, so undoing stops when it's empty
+        undone = undo_everything(top);
+        CHECK(program.undo_buffer.delta_count == 0 && program.undo_journal_count == 0, "undo stopped after %d edits of %d", undone, top);
+        s24 redos = cast(s24)program.redo_buffer.delta_count;
+        for(; redone < redos && failures == 0; ++redone) {
+            Delta *redo = pop_delta(&program.redo_buffer);
+            CHECK(redo, "redo %d is missing", redone);
+            if(!redo) { break; }
+            apply_delta_to_program(redo, &program.undo_buffer);
+            CHECK(hash_program() == hashes[top - undone + 1 + redone], "redo %d isn't the program it was", redone);
+        }
+
+        // NOTE: The journal outlives loading the same program again
+        top = top - undone + redone;
+        save_program();
+        close_undo_journal();
+        archive_program_if_it_was();
+        load_program(name);
+        CHECK(hash_program() == hashes[top], "the program changed when loaded again");
+        s24 undone_again = undo_everything(top);
+        CHECK(undone_again == top || undone_again >= redone, "undid %d edits of %d after loading again", undone_again, top);
+        reloaded = failures == 0;
+
+        // NOTE: ...but not the program changing
+        save_program();
+        close_undo_journal();
+        archive_program_if_it_was();
+        insert_tokens_(0, cast(u8*)"A", 1, null);
+        save_program();
+        load_program(name);
+        CHECK(program.undo_journal_count == 0 && program.undo_buffer.delta_count == 0, "the journal of a changed program was kept");
+    }
+    printf("%-9s %-5s %6d %-3s %6d %6d %8d %6d %6d %-4s %9ld  %s\n", name, long_lines ? "long" : "short", size,
+           windowed ? "yes" : "no", steps, saves, replaced, undone, redone, reloaded ? "yes" : "no", saves ? written/saves : 0,
+           failures ? "FAILED" : "ok");
+    close_undo_journal();
+    close_program_window();
+}
+
+int main(void) {
+    bench_start_editor();
+    printf("%-9s %-5s %6s %-3s %6s %6s %8s %6s %6s %-4s %9s\n", "run", "lines", "size", "win", "edits", "saves", "replaced",
+           "undone", "redone", "load", "written");
+    int failed = 0;
+    run_edits("WHOLE", SaveMode_Whole, false, 4500, 4000, 1234);
+    failed += failures != 0;
+    run_edits("SLICED", SaveMode_Sliced, false, 4500, 4000, 1234);
+    failed += failures != 0;
+    run_edits("LONG", SaveMode_Whole, true, 4500, 4000, 99);
+    failed += failures != 0;
+    run_edits("WINDOWED", SaveMode_Windowed, false, 50000, 1500, 7);
+    failed += failures != 0;
+    return failed;
+}
@@ -0,0 +1,188 @@
+// NOTE: Not a benchmark but a check: after random keys, cursor moves, undos, selections, dialogs, searches,
+// label browsing and theme changes, the frame render draws (which only redraws what changed) has to be
+// the same, pixel for pixel, as a full redraw from the same state. Runs three seeds, 3000 frames each.
+// The exit status is how many seeds had a frame that differed.
+#include "bench.h"
+
+extern uint8_t host_visible;
+
+static u8 frame[240][320];
+static u8 frames_after[2][240][320];
+static LoadedProgram program_before;
+static LoadedProgram program_after;
+static Editor editor_before;
+
+s24 random_token(u8 *out) {
+    static const u8 two_byte_prefixes[] = {0x5C, 0x5D, 0x5E, 0x60, 0x61, 0x62, 0x63, 0x7E, 0xAA, 0xBB, 0xEF};
+    s24 kind = rand() % 20;
+    s24 result = 1;
+    if(kind < 3) {
+        out[0] = LINEBREAK;
+    } else if(kind < 5) {
+        out[0] = two_byte_prefixes[rand() % ARRLEN(two_byte_prefixes)];
+        out[1] = cast(u8)(0x3F + rand() % 0x30);
+        result = 2;
+    } else if(kind < 8) {
+        out[0] = SPACE;
+    } else if(kind < 10) {
+        // NOTE: If, Then, While, End and Lbl
+        u8 blocks[] = {0xCE, 0xCF, 0xD1, 0xD4, LBL};
+        out[0] = blocks[rand() % 5];
+    } else {
+        out[0] = cast(u8)('A' + rand() % 26);
+    }
+    return result;
+}
+
+s24 token_start_at_or_after(s24 target) {
+    s24 line = max(0, calculate_line_y(max(0, target)));
+    s24 result = get_linebreak_location(line) + 1;
+    while(result < target && result < program.size) {
+        result += get_token_size(result);
+    }
+    return min(result, program.size);
+}
+
+void random_action(void) {
+    s24 action = rand() % 100;
+    if(program.browsing_labels && action >= 45 && action < 76) {
+        action = 0;
+    }
+    if(action < 30) {
+        s24 spread = 1 + rand() % 40;
+        program.cursor = token_start_at_or_after(program.cursor + rand() % (2*spread + 1) - spread);
+    } else if(action < 35) {
+        program.cursor = token_start_at_or_after(rand() % (program.size + 1));
+    } else if(action < 45) {
+        if(!program.cursor_selecting) {
+            program.cursor_selecting = true;
+            program.cursor_started_selecting = program.cursor;
+        } else {
+            program.cursor_selecting = false;
+        }
+    } else if(action < 60) {
+        u8 tokens[4];
+        s24 count = random_token(tokens);
+        count += random_token(tokens + count);
+        program.cursor_selecting = false;
+        insert_tokens(program.cursor, tokens, cast(u16)count);
+        program.cursor += count;
+    } else if(action < 72) {
+        program.cursor_selecting = false;
+        if(program.cursor < program.size) {
+            remove_tokens(program.cursor, get_token_size(program.cursor));
+        }
+    } else if(action < 76) {
+        Delta *undo = pop_delta(&program.undo_buffer);
+        if(undo) {
+            apply_delta_to_program(undo, &program.redo_buffer);
+        }
+    } else if(action < 79) {
+        editor.cursor_mode = cast(CursorMode)(rand() % 3);
+        editor.alpha_is_lowercase = rand() % 2;
+    } else if(action < 81) {
+        program.entering_goto = !program.entering_goto;
+        program.entering_goto_chars_count = 0;
+    } else if(action < 82) {
+        editor.settings.light_mode = !editor.settings.light_mode;
+        update_editor_theme_based_on_settings();
+        program.redraw_all = true;
+    } else if(action < 83) {
+        program.opened_directory = program.opened_directory ? null : &directories[0];
+    } else if(action < 85) {
+        if(rand() % 3 == 0) {
+            clear_search_tokens();
+        } else if(program.cursor < program.size) {
+            set_search_tokens(program.cursor, 1 + rand() % 3);
+        }
+    } else if(action < 86) {
+        if(program.browsing_labels) {
+            program.browsing_labels = false;
+        } else {
+            open_label_browser();
+        }
+    } else if(action < 88 && program.browsing_labels && program.labels_count > 0) {
+        program.label_browser_index = rand() % program.labels_count;
+    }
+    program.cursor = min(program.cursor, program.size);
+}
+
+// NOTE: Returns how many frames differed
+int check_frames(u32 seed) {
+    int result = 0;
+    srand(seed);
+    static u8 data[20000];
+    s24 size = 0;
+    for(s24 i = 0; i < 2500; ++i) {
+        size += random_token(data + size);
+    }
+    host_create("FRAMES", OS_TYPE_PRGM, data, size);
+    load_program("FRAMES");
+    int noclip_violations_were = host_noclip_violations;
+
+    for(s24 step = 0; step < 3000; ++step) {
+        random_action();
+        keep_program_indexed_around_cursor();
+        if(rand() % 4 == 0 && !program.fully_indexed) {
+            index_program(PROGRAM_INDEX_SLICE_BYTES);
+        }
+
+        program_before = program;
+        editor_before = editor;
+        render();
+        present_frame();
+        memcpy(frame, host_frames[host_visible], sizeof(frame));
+        program_after = program;
+        Editor editor_after = editor;
+        memcpy(frames_after, host_frames, sizeof(host_frames));
+        u8 visible_after = host_visible;
+        u8 draw_after = host_draw;
+
+        // NOTE: The same frame again, from the same state, but all of it
+        program = program_before;
+        editor = editor_before;
+        program.redraw_all = true;
+        render();
+        s24 differing = 0;
+        s24 first_x = 0;
+        s24 first_y = 0;
+        for(s24 y = 0; y < 240; ++y) {
+            for(s24 x = 0; x < 320; ++x) {
+                if(host_frames[host_draw][y][x] != frame[y][x]) {
+                    if(differing == 0) {
+                        first_x = x;
+                        first_y = y;
+                    }
+                    differing += 1;
+                }
+            }
+        }
+        if(differing) {
+            result += 1;
+            if(result <= 5) {
+                fprintf(stderr, "seed %u frame %d: %d pixels differ from a full redraw, first at %d,%d (top line %d, cursor %d)\n",
+                        seed, step, differing, first_x, first_y, program_after.view_top_line, program_after.cursor);
+            }
+        }
+
+        program = program_after;
+        editor = editor_after;
+        memcpy(host_frames, frames_after, sizeof(host_frames));
+        host_visible = visible_after;
+        host_draw = draw_after;
+    }
+    printf("%4u %6d %8d %6d\n", seed, 3000, result, host_noclip_violations - noclip_violations_were);
+    result += host_noclip_violations - noclip_violations_were;
+    close_undo_journal();
+    return result;
+}
+
+int main(void) {
+    bench_start_editor();
+    printf("%4s %6s %8s %6s\n", "seed", "frames", "differed", "noclip");
+    int failed = 0;
+    for(u32 seed = 1; seed <= 3; ++seed) {
+        failed += check_frames(seed) != 0;
+    }
+    return failed;
+}
@@ -0,0 +1,52 @@
+// NOTE: Goto latency on a 40 KB program: find_label_named and go_to_label for every label name, with the label index,
+// on the first goto after a label was edited (when the index sorts its names again), and with more than LABELS_MAX
+// labels, when find_label_named walks the program like every goto did before the index.
+// The first goto after loading sorts the names, so it's shown apart from the rest.
+#include "bench.h"
+
+#define PROGRAM_SIZE (40000)
+
+void time_gotos(const char *what, s24 labels_every, bool resort_before_each) {
+    s24 labels = bench_make_program("BENCH", PROGRAM_SIZE, labels_every);
+    load_program("BENCH");
+    require_full_index();
+    // NOTE: Every distinct name, AA to ZZ, as the generator names them
+    s24 names = min(labels, 26*26);
+    double total_ns = 0;
+    double first_ns = 0;
+    s24 found = 0;
+    for(s24 i = 0; i < names; ++i) {
+        u16 name = cast(u16)((('A' + (i/26) % 26) << 8) | ('A' + i % 26));
+        if(resort_before_each) {
+            program.labels_by_name_dirty = true;
+        }
+        double started = bench_ns();
+        s24 label_at = find_label_named(name);
+        if(label_at >= 0) {
+            go_to_label(label_at);
+            found += 1;
+        }
+        double took = bench_ns() - started;
+        if(i == 0) {
+            first_ns = took;
+        } else {
+            total_ns += took;
+        }
+    }
+    printf("%-22s %6d %10s %8d %12.0f %12.0f\n", what, labels, program.labels_overflowed ? "yes" : "no",
+           found, first_ns, total_ns/(names - 1));
+    save_program();
+    close_undo_journal();
+}
+
+int main(void) {
+    bench_start_editor();
+    printf("%-22s %6s %10s %8s %12s %12s\n", "", "labels", "overflowed", "gotos", "1st goto ns", "next ns/goto");
+    time_gotos("index", 6, false);
+    time_gotos("index, sorted again", 6, true);
+    time_gotos("index", 4, false);
+    time_gotos("index, sorted again", 4, true);
+    time_gotos("overflow, walk", 3, false);
+    time_gotos("overflow, walk", 2, false);
+    return 0;
+}
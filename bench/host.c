@@ -0,0 +1,374 @@
+// NOTE: Stand-ins for TI-OS, fileioc, graphx, fontlibc and keypadc, so main.c runs on a PC.
+// Variables live in RAM, graphx draws into host_frames (host_visible is the LCD),
+// and fontlibc draws a made up 7x8 pattern for each glyph, a bit at a time like the real one.
+// The host_ counters are what the benchmarks report, since PC timings say little about an eZ80.
+#include "include/fileioc.h"
+#include "include/graphx.h"
+#include "include/fontlibc.h"
+#include "include/keypadc.h"
+#include "include/sys/timers.h"
+#include "include/ti/screen.h"
+#include "include/debug.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+long host_token_string_calls = 0;
+long host_written_bytes = 0;
+long host_blit_bytes = 0;
+long host_glyphs = 0;
+long host_garbage_collects = 0;
+int host_noclip_violations = 0;
+// NOTE: When set, archiving a variable garbage collects like TI-OS does when the archive is full,
+// which calls the ti_SetGCBehavior callbacks and wipes VRAM the way gfx_Begin does.
+bool host_archiving_collects = false;
+
+// ---- Variables
+
+typedef struct HostVar {
+    char name[9];
+    uint8_t type;
+    bool used;
+    bool archived;
+    int size;
+    uint8_t data[70000];
+} HostVar;
+static HostVar vars[40];
+
+typedef struct HostHandle {
+    int var;
+    int position;
+    bool used;
+} HostHandle;
+static HostHandle handles[8];
+
+static int find_var(const char *name, uint8_t type) {
+    for(int i = 0; i < 40; ++i) {
+        if(vars[i].used && vars[i].type == type && strcmp(vars[i].name, name) == 0) { return i; }
+    }
+    return -1;
+}
+
+int host_create(const char *name, uint8_t type, const void *data, int size) {
+    int i = find_var(name, type);
+    if(i < 0) {
+        for(i = 0; i < 40 && vars[i].used; ++i) {}
+    }
+    if(i >= 40) {
+        fprintf(stderr, "host: out of variables\n");
+        exit(1);
+    }
+    vars[i].used = true;
+    vars[i].archived = false;
+    strncpy(vars[i].name, name, 8);
+    vars[i].name[8] = 0;
+    vars[i].type = type;
+    memcpy(vars[i].data, data, (size_t)size);
+    vars[i].size = size;
+    return i;
+}
+
+HostVar *host_var(const char *name, uint8_t type) {
+    int i = find_var(name, type);
+    return i < 0 ? NULL : &vars[i];
+}
+
+int host_var_size(const char *name, uint8_t type) {
+    int i = find_var(name, type);
+    return i < 0 ? -1 : vars[i].size;
+}
+
+const uint8_t *host_var_data(const char *name, uint8_t type) {
+    int i = find_var(name, type);
+    return i < 0 ? NULL : vars[i].data;
+}
+
+uint8_t ti_OpenVar(const char *name, const char *mode, uint8_t type) {
+    int i = find_var(name, type);
+    if(i < 0) {
+        if(mode[0] == 'r') { return 0; }
+        i = host_create(name, type, "", 0);
+    }
+    if(mode[0] == 'w') { vars[i].size = 0; }
+    for(uint8_t handle = 1; handle < 8; ++handle) {
+        if(!handles[handle].used) {
+            handles[handle].used = true;
+            handles[handle].var = i;
+            handles[handle].position = (mode[0] == 'a') ? vars[i].size : 0;
+            return handle;
+        }
+    }
+    return 0;
+}
+uint8_t ti_Open(const char *name, const char *mode) { return ti_OpenVar(name, mode, OS_TYPE_APPVAR); }
+int ti_Close(uint8_t handle) { handles[handle].used = false; return 1; }
+
+size_t ti_Write(const void *data, size_t size, size_t count, uint8_t handle) {
+    HostVar *var = &vars[handles[handle].var];
+    if(handles[handle].position + (int)(size*count) > (int)sizeof(var->data)) { return 0; }
+    host_written_bytes += (long)(size*count);
+    memcpy(var->data + handles[handle].position, data, size*count);
+    handles[handle].position += (int)(size*count);
+    if(handles[handle].position > var->size) { var->size = handles[handle].position; }
+    return count;
+}
+
+size_t ti_Read(void *data, size_t size, size_t count, uint8_t handle) {
+    HostVar *var = &vars[handles[handle].var];
+    size_t read = 0;
+    while(read < count && handles[handle].position + (int)size <= var->size) {
+        memcpy((char*)data + read*size, var->data + handles[handle].position, size);
+        handles[handle].position += (int)size;
+        read += 1;
+    }
+    return read;
+}
+
+int ti_Seek(int offset, unsigned int origin, uint8_t handle) {
+    HostVar *var = &vars[handles[handle].var];
+    int base = (origin == SEEK_SET) ? 0 : (origin == SEEK_CUR) ? handles[handle].position : var->size;
+    handles[handle].position = base + offset;
+    return 0;
+}
+uint16_t ti_Tell(uint8_t handle) { return (uint16_t)handles[handle].position; }
+uint16_t ti_GetSize(uint8_t handle) { return (uint16_t)vars[handles[handle].var].size; }
+int ti_Resize(size_t size, uint8_t handle) {
+    HostVar *var = &vars[handles[handle].var];
+    if((int)size > var->size) { memset(var->data + var->size, 0, size - (size_t)var->size); }
+    var->size = (int)size;
+    return (int)size;
+}
+void *ti_GetDataPtr(const uint8_t handle) { return vars[handles[handle].var].data + handles[handle].position; }
+int ti_IsArchived(uint8_t handle) { return vars[handles[handle].var].archived; }
+
+static void (*gc_before)(void);
+static void (*gc_after)(void);
+void ti_SetGCBehavior(void (*before)(void), void (*after)(void)) { gc_before = before; gc_after = after; }
+
+int ti_SetArchiveStatus(bool archive, uint8_t handle) {
+    if(archive && !vars[handles[handle].var].archived && host_archiving_collects) {
+        host_garbage_collects += 1;
+        if(gc_before) { gc_before(); }
+        memset(host_frames, 0xA5, sizeof(host_frames));
+        if(gc_after) { gc_after(); }
+    }
+    vars[handles[handle].var].archived = archive;
+    return 1;
+}
+bool ti_ArchiveHasRoomVar(uint8_t handle) { (void)handle; return true; }
+
+// NOTE: vat_ptr just counts through vars
+char *ti_DetectVar(void **vat_ptr, const char *detection_string, uint8_t type) {
+    (void)detection_string;
+    intptr_t i = (intptr_t)*vat_ptr;
+    for(; i < 40; ++i) {
+        if(vars[i].used && vars[i].type == type) {
+            *vat_ptr = (void*)(i + 1);
+            return vars[i].name;
+        }
+    }
+    *vat_ptr = (void*)i;
+    return NULL;
+}
+int ti_Delete(const char *name) { return ti_DeleteVar(name, OS_TYPE_APPVAR); }
+int ti_DeleteVar(const char *name, uint8_t type) {
+    int i = find_var(name, type);
+    if(i >= 0) { vars[i].used = false; }
+    return 1;
+}
+
+// NOTE: Made up token strings: two byte tokens are their hex ("BB6A"), letters and digits are themselves,
+// and other one byte tokens are "t" and their hex. Close enough in length to the real ones.
+char *ti_GetTokenString(void **read_pointer, uint8_t *length_of_token, unsigned int *length_of_string) {
+    static char string[16];
+    host_token_string_calls += 1;
+    uint8_t *token = *read_pointer;
+    uint8_t x = token[0];
+    bool two_bytes = (x == 0x5C || x == 0x5D || x == 0x5E || x == 0x60 || x == 0x61 || x == 0x62 || x == 0x63 ||
+                      x == 0x7E || x == 0xAA || x == 0xBB || x == 0xEF);
+    unsigned int length;
+    if(two_bytes) {
+        sprintf(string, "%02X%02X", token[0], token[1]);
+        length = 4;
+    } else if((x >= 'A' && x <= 'Z') || (x >= '0' && x <= '9')) {
+        string[0] = (char)x;
+        string[1] = 0;
+        length = 1;
+    } else {
+        sprintf(string, "t%02X", x);
+        length = 3;
+    }
+    if(length_of_string) { *length_of_string = length; }
+    if(length_of_token) { *length_of_token = two_bytes ? 2 : 1; }
+    *read_pointer = token + (two_bytes ? 2 : 1);
+    return string;
+}
+
+// ---- OS
+
+size_t os_MemChk(void **free) { (void)free; return 100000; }
+int os_RunPrgm(const char *program, void *data, size_t size, int (*callback)(void *data, int retval)) {
+    (void)program; (void)data; (void)size; (void)callback;
+    return 0;
+}
+void msleep(uint16_t milliseconds) { (void)milliseconds; }
+void dbg_printf(const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    if(getenv("HOST_LOG")) { vfprintf(stderr, format, arguments); }
+    va_end(arguments);
+}
+
+// ---- Keypad
+
+volatile uint8_t kb_Data[8];
+bool kb_On;
+void kb_Scan(void) {}
+void kb_DisableOnLatch(void) {}
+
+// ---- graphx
+
+uint8_t host_frames[2][240][320];
+uint8_t host_visible = 0;
+uint8_t host_draw = 1;
+static uint8_t color;
+static int clip_min_x = 0, clip_min_y = 0, clip_max_x = 320, clip_max_y = 240;
+
+static void plot(int x, int y) {
+    if(x >= 0 && x < 320 && y >= 0 && y < 240) { host_frames[host_draw][y][x] = color; }
+}
+static void check_noclip(int x, int y, int width, int height) {
+    if(x < 0 || y < 0 || x + width > 320 || y + height > 240) {
+        host_noclip_violations += 1;
+        fprintf(stderr, "host: NoClip drawing out of bounds %d %d %d %d\n", x, y, width, height);
+    }
+}
+static uint8_t *frame_of(gfx_location_t location) {
+    return &host_frames[location == gfx_buffer ? !host_visible : host_visible][0][0];
+}
+
+void gfx_Begin(void) {}
+void gfx_End(void) {}
+void gfx_SetDraw(uint8_t location) { host_draw = (location == gfx_buffer) ? !host_visible : host_visible; }
+void gfx_SwapDraw(void) { host_visible = !host_visible; host_draw = !host_visible; }
+uint8_t gfx_GetDraw(void) { return host_draw != host_visible; }
+void gfx_Wait(void) {}
+void gfx_FillScreen(uint8_t index) { memset(host_frames[host_draw], index, 320*240); }
+uint8_t gfx_SetColor(uint8_t index) { uint8_t old = color; color = index; return old; }
+void gfx_SetClipRegion(int min_x, int min_y, int max_x, int max_y) {
+    clip_min_x = min_x; clip_min_y = min_y; clip_max_x = max_x; clip_max_y = max_y;
+}
+
+void gfx_FillRectangle(int x, int y, int width, int height) {
+    for(int j = y; j < y + height; ++j) {
+        for(int i = x; i < x + width; ++i) {
+            if(i >= clip_min_x && i < clip_max_x && j >= clip_min_y && j < clip_max_y) { plot(i, j); }
+        }
+    }
+}
+void gfx_FillRectangle_NoClip(uint24_t x, uint8_t y, uint24_t width, uint8_t height) {
+    check_noclip((int)x, y, (int)width, height);
+    for(int j = y; j < y + height; ++j) {
+        for(int i = (int)x; i < (int)(x + width); ++i) { plot(i, j); }
+    }
+}
+void gfx_Rectangle_NoClip(uint24_t x, uint8_t y, uint24_t width, uint8_t height) {
+    check_noclip((int)x, y, (int)width, height);
+    for(int i = (int)x; i < (int)(x + width); ++i) { plot(i, y); plot(i, y + height - 1); }
+    for(int j = y; j < y + height; ++j) { plot((int)x, j); plot((int)(x + width - 1), j); }
+}
+void gfx_HorizLine_NoClip(uint24_t x, uint8_t y, uint24_t length) {
+    check_noclip((int)x, y, (int)length, 1);
+    for(int i = (int)x; i < (int)(x + length); ++i) { plot(i, y); }
+}
+
+// NOTE: The blits copy from src to the other frame, and count the bytes for the benchmarks
+void gfx_Blit(gfx_location_t src) {
+    host_blit_bytes += 320*240;
+    memcpy(frame_of(!src), frame_of(src), 320*240);
+}
+void gfx_BlitLines(gfx_location_t src, uint8_t y, uint8_t count) {
+    host_blit_bytes += count*320;
+    check_noclip(0, y, 320, count);
+    memcpy(frame_of(!src) + y*320, frame_of(src) + y*320, (size_t)count*320);
+}
+void gfx_BlitRectangle(gfx_location_t src, uint24_t x, uint8_t y, uint24_t width, uint24_t height) {
+    host_blit_bytes += (long)(width*height);
+    check_noclip((int)x, y, (int)width, (int)height);
+    for(unsigned j = y; j < y + height; ++j) {
+        memcpy(frame_of(!src) + j*320 + x, frame_of(src) + j*320 + x, width);
+    }
+}
+void gfx_CopyRectangle(gfx_location_t src, gfx_location_t dst, uint24_t src_x, uint8_t src_y,
+                       uint24_t dst_x, uint8_t dst_y, uint24_t width, uint8_t height) {
+    host_blit_bytes += (long)(width*height);
+    check_noclip((int)src_x, src_y, (int)width, height);
+    check_noclip((int)dst_x, dst_y, (int)width, height);
+    for(unsigned j = 0; j < height; ++j) {
+        memmove(frame_of(dst) + (dst_y + j)*320 + dst_x, frame_of(src) + (src_y + j)*320 + src_x, width);
+    }
+}
+void gfx_ShiftUp(uint24_t pixels) {
+    for(int j = clip_min_y; j + (int)pixels < clip_max_y; ++j) {
+        memmove(&host_frames[host_draw][j][clip_min_x], &host_frames[host_draw][j + pixels][clip_min_x],
+                (size_t)(clip_max_x - clip_min_x));
+    }
+}
+void gfx_ShiftDown(uint24_t pixels) {
+    for(int j = clip_max_y - 1; j - (int)pixels >= clip_min_y; --j) {
+        memmove(&host_frames[host_draw][j][clip_min_x], &host_frames[host_draw][j - pixels][clip_min_x],
+                (size_t)(clip_max_x - clip_min_x));
+    }
+}
+
+// ---- fontlibc
+
+static int font_x, font_y;
+static uint8_t font_foreground, font_background;
+static bool font_transparent;
+bool fontlib_SetFont(const fontlib_font_t *font, uint8_t flags) { (void)font; (void)flags; return true; }
+void fontlib_SetCursorPosition(unsigned int x, uint8_t y) { font_x = (int)x; font_y = y; }
+void fontlib_SetForegroundColor(uint8_t c) { font_foreground = c; }
+void fontlib_SetBackgroundColor(uint8_t c) { font_background = c; }
+void fontlib_SetTransparency(bool transparent) { font_transparent = transparent; }
+void fontlib_SetFirstPrintableCodePoint(char code_point) { (void)code_point; }
+
+// NOTE: Made up glyph patterns, 7 bits per row, leftmost pixel in the top bit
+static uint8_t glyph_rows[256][8];
+static bool glyph_rows_made = false;
+static void make_glyph_rows(void) {
+    for(int glyph = 0; glyph < 256; ++glyph) {
+        for(int j = 0; j < 8; ++j) {
+            unsigned hash = ((unsigned)glyph*2654435761u) ^ ((unsigned)j*7919u);
+            hash ^= hash >> 13;
+            hash *= 0x5bd1e995;
+            hash ^= hash >> 15;
+            glyph_rows[glyph][j] = (uint8_t)(hash & 0xFE);
+        }
+    }
+    glyph_rows_made = true;
+}
+
+unsigned int fontlib_DrawGlyph(uint8_t glyph) {
+    if(!glyph_rows_made) { make_glyph_rows(); }
+    host_glyphs += 1;
+    uint8_t old = color;
+    for(int j = 0; j < 8; ++j) {
+        for(int i = 0; i < 7; ++i) {
+            bool on = (glyph_rows[glyph][j] & (0x80 >> i)) != 0;
+            if(on || !font_transparent) {
+                color = on ? font_foreground : font_background;
+                if(font_x + i < 320 && font_y + j < 240) { plot(font_x + i, font_y + j); } else { host_noclip_violations += 1; }
+            }
+        }
+    }
+    color = old;
+    font_x += 7;
+    return (unsigned int)font_x;
+}
+unsigned int fontlib_DrawStringL(const char *string, size_t max_characters) {
+    for(size_t i = 0; string[i] && i < max_characters; ++i) { fontlib_DrawGlyph((uint8_t)string[i]); }
+    return (unsigned int)font_x;
+}
+unsigned int fontlib_DrawString(const char *string) { return fontlib_DrawStringL(string, (size_t)-1); }
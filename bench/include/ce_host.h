@@ -0,0 +1,8 @@
+// NOTE: What the CE toolchain's headers give main.c, for building it on a PC.
+// ints stand in for the eZ80's 24 bit ints, so sizes and wrap-around differ from the calculator.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+typedef unsigned int uint24_t;
+typedef int int24_t;
@@ -0,0 +1,2 @@
+#pragma once
+void dbg_printf(const char *format, ...);
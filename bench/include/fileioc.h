@@ -0,0 +1,28 @@
+#pragma once
+#include "ce_host.h"
+#define OS_TYPE_PRGM 5
+#define OS_TYPE_PROT_PRGM 6
+#define OS_TYPE_APPVAR 0x15
+#define OS_TYPE_REAL_LIST 1
+#define OS_VAR_MAX_SIZE 65512
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+uint8_t ti_Open(const char *name, const char *mode);
+uint8_t ti_OpenVar(const char *varname, const char *mode, uint8_t type);
+int ti_Close(uint8_t handle);
+size_t ti_Write(const void *data, size_t size, size_t count, uint8_t handle);
+size_t ti_Read(void *data, size_t size, size_t count, uint8_t handle);
+int ti_Seek(int offset, unsigned int origin, uint8_t handle);
+uint16_t ti_Tell(uint8_t handle);
+uint16_t ti_GetSize(uint8_t handle);
+int ti_Resize(size_t size, uint8_t handle);
+int ti_IsArchived(uint8_t handle);
+int ti_SetArchiveStatus(bool archive, uint8_t handle);
+bool ti_ArchiveHasRoomVar(uint8_t handle);
+char *ti_DetectVar(void **vat_ptr, const char *detection_string, uint8_t var_type);
+int ti_Delete(const char *name);
+int ti_DeleteVar(const char *varname, uint8_t type);
+void *ti_GetDataPtr(const uint8_t handle);
+char *ti_GetTokenString(void **read_pointer, uint8_t *length_of_token, unsigned int *length_of_string);
+void ti_SetGCBehavior(void (*before)(void), void (*after)(void));
@@ -0,0 +1,12 @@
+#pragma once
+#include "ce_host.h"
+typedef struct fontlib_font_t { uint8_t fontVersion; } fontlib_font_t;
+bool fontlib_SetFont(const fontlib_font_t *font_data, uint8_t flags);
+void fontlib_SetCursorPosition(unsigned int x, uint8_t y);
+void fontlib_SetForegroundColor(uint8_t color);
+void fontlib_SetBackgroundColor(uint8_t color);
+void fontlib_SetTransparency(bool transparency);
+void fontlib_SetFirstPrintableCodePoint(char code_point);
+unsigned int fontlib_DrawString(const char *str);
+unsigned int fontlib_DrawStringL(const char *str, size_t max_characters);
+unsigned int fontlib_DrawGlyph(uint8_t glyph);
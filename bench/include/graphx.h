@@ -0,0 +1,32 @@
+#pragma once
+#include "ce_host.h"
+#define GFX_LCD_WIDTH 320
+#define GFX_LCD_HEIGHT 240
+typedef enum { gfx_screen = 0, gfx_buffer = 1 } gfx_location_t;
+void gfx_Begin(void); void gfx_End(void);
+void gfx_SetDraw(uint8_t location);
+#define gfx_SetDrawBuffer() gfx_SetDraw(gfx_buffer)
+#define gfx_SetDrawScreen() gfx_SetDraw(gfx_screen)
+void gfx_SwapDraw(void);
+void gfx_FillScreen(uint8_t index);
+uint8_t gfx_SetColor(uint8_t index);
+void gfx_FillRectangle(int x, int y, int width, int height);
+void gfx_FillRectangle_NoClip(uint24_t x, uint8_t y, uint24_t width, uint8_t height);
+void gfx_Rectangle_NoClip(uint24_t x, uint8_t y, uint24_t width, uint8_t height);
+void gfx_HorizLine_NoClip(uint24_t x, uint8_t y, uint24_t length);
+void gfx_Blit(gfx_location_t src);
+void gfx_BlitLines(gfx_location_t src, uint8_t y_loc, uint8_t num_lines);
+void gfx_BlitRectangle(gfx_location_t src, uint24_t x, uint8_t y, uint24_t width, uint24_t height);
+#define gfx_BlitScreen() gfx_Blit(gfx_screen)
+#define gfx_BlitBuffer() gfx_Blit(gfx_buffer)
+void gfx_SetClipRegion(int xmin, int ymin, int xmax, int ymax);
+void gfx_ShiftUp(uint24_t pixels);
+void gfx_ShiftDown(uint24_t pixels);
+uint8_t gfx_GetDraw(void);
+void gfx_Wait(void);
+void gfx_CopyRectangle(gfx_location_t src, gfx_location_t dst, uint24_t src_x, uint8_t src_y, uint24_t dst_x, uint8_t dst_y, uint24_t width, uint8_t height);
+// NOTE: VRAM is host.c's two frames, and the back buffer is whichever one isn't shown
+extern uint8_t host_frames[2][240][320];
+extern uint8_t host_draw;
+#define gfx_vbuffer (host_frames[host_draw])
+#define gfx_vram ((uint16_t*)host_frames)
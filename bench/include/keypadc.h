@@ -0,0 +1,13 @@
+#pragma once
+#include "ce_host.h"
+extern volatile uint8_t kb_Data[8];
+void kb_Scan(void);
+void kb_DisableOnLatch(void);
+extern bool kb_On;
+enum { kb_Graph=1,kb_Trace=2,kb_Zoom=4,kb_Window=8,kb_Yequ=16,kb_2nd=32,kb_Mode=64,kb_Del=128 };
+enum { kb_Sto=2,kb_Ln=4,kb_Log=8,kb_Square=16,kb_Recip=32,kb_Math=64,kb_Alpha=128 };
+enum { kb_0=1,kb_1=2,kb_4=4,kb_7=8,kb_Comma=16,kb_Sin=32,kb_Apps=64,kb_GraphVar=128 };
+enum { kb_DecPnt=1,kb_2=2,kb_5=4,kb_8=8,kb_LParen=16,kb_Cos=32,kb_Prgm=64,kb_Stat=128 };
+enum { kb_Chs=1,kb_3=2,kb_6=4,kb_9=8,kb_RParen=16,kb_Tan=32,kb_Vars=64 };
+enum { kb_Enter=1,kb_Add=2,kb_Sub=4,kb_Mul=8,kb_Div=16,kb_Power=32,kb_Clear=64 };
+enum { kb_Down=1,kb_Left=2,kb_Right=4,kb_Up=8 };
@@ -0,0 +1,3 @@
+#pragma once
+#include "../ce_host.h"
+void msleep(uint16_t milliseconds);
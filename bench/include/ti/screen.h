@@ -0,0 +1,4 @@
+#pragma once
+#include "../ce_host.h"
+size_t os_MemChk(void **free);
+int os_RunPrgm(const char *program, void *data, size_t size, int (*callback)(void *data, int retval));
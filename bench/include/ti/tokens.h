@@ -0,0 +1,24 @@
+#pragma once
+#define OS_TOK_INV_SIN 0xC3
+#define OS_TOK_INV_COS 0xC5
+#define OS_TOK_INV_TAN 0xC7
+#define OS_TOK_PI 0xAC
+#define OS_TOK_SQRT 0xBC
+#define OS_TOK_EXP_10 0xC1
+#define OS_TOK_LEFT_BRACE 0x08
+#define OS_TOK_RIGHT_BRACE 0x09
+#define OS_TOK_INV_LOG 0xC1
+#define OS_TOK_EQU 0x5E
+#define OS_TOK_EQU_U 0x80
+#define OS_TOK_EQU_V 0x81
+#define OS_TOK_EQU_W 0x82
+#define OS_TOK_LEFT_BRACKET 0x06
+#define OS_TOK_RIGHT_BRACKET 0x07
+#define OS_TOK_LIST 0x5D
+#define OS_TOK_LIST_L1 0
+#define OS_TOK_LIST_L2 1
+#define OS_TOK_LIST_L3 2
+#define OS_TOK_LIST_L4 3
+#define OS_TOK_LIST_L5 4
+#define OS_TOK_LIST_L6 5
+#define OS_TOK_LIST_L 0xEB
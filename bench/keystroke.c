@@ -0,0 +1,54 @@
+// NOTE: Per-keystroke cost of typing and deleting at the start, middle and end of a 40 KB program.
+// The first key at a place pays for moving the gap there, the rest only move their own bytes.
+// Before the gap buffer, each key shifted every byte after the cursor, which is the "old" column.
+#include "bench.h"
+
+#define PROGRAM_SIZE (40000)
+#define KEYS (32)
+
+void type_at(const char *where, s24 at) {
+    double key_ns[KEYS*2];
+    long key_moved[KEYS*2];
+    s24 old_moved = 0;
+    program.cursor = at;
+    keep_program_window_around_cursor();
+    for(s24 i = 0; i < KEYS*2; ++i) {
+        long moved_was = bench_moved_bytes;
+        double started = bench_ns();
+        if(i < KEYS) {
+            old_moved += program.size - program.cursor;
+            insert_token_u8(program.cursor, cast(u8)('A' + i % 26));
+            program.cursor += 1;
+        } else {
+            program.cursor -= 1;
+            old_moved += program.size - program.cursor - 1;
+            remove_tokens(program.cursor, 1);
+        }
+        key_ns[i] = bench_ns() - started;
+        key_moved[i] = bench_moved_bytes - moved_was;
+    }
+    double rest_ns = 0;
+    long rest_moved = 0;
+    for(s24 i = 1; i < KEYS*2; ++i) {
+        rest_ns += key_ns[i];
+        rest_moved += key_moved[i];
+    }
+    printf("%-7s %9ld %9.0f %12.1f %9.0f %12ld\n", where, key_moved[0], key_ns[0],
+           cast(double)rest_moved/(KEYS*2 - 1), rest_ns/(KEYS*2 - 1), cast(long)old_moved/(KEYS*2));
+}
+
+int main(void) {
+    bench_make_program("BENCH", PROGRAM_SIZE, 0);
+    bench_start_editor();
+    load_program("BENCH");
+    require_full_index();
+    s24 middle = get_linebreak_location(program.linebreaks_count/2) + 1;
+    printf("%d byte program, %d keys typed then deleted at each place\n", program.size, KEYS*2);
+    printf("%-7s %9s %9s %12s %9s %12s\n", "", "1st key", "1st ns", "next keys", "next ns", "old");
+    printf("%-7s %9s %9s %12s %9s %12s\n", "", "moved", "", "moved/key", "/key", "moved/key");
+    type_at("end", program.size);
+    type_at("middle", middle);
+    type_at("start", 0);
+    type_at("end", program.size);
+    return 0;
+}
@@ -0,0 +1,72 @@
+// NOTE: What the line index costs for programs of many short lines, up to 65505 lines of nothing.
+// The heap column is what the line blocks take on the calculator, worked out from the eZ80 sizes of
+// Linebreak, LineBlock and IndentationStep, since they're bigger on a PC. Then each program is loaded again
+// with the heap limited to less than it needs, which has to end with a message instead of a crash,
+// and typing Enter with the heap full has to leave a notice.
+#include "bench.h"
+
+#define CE_LINEBREAK_BYTES 6
+#define CE_LINE_BLOCK_BYTES 10
+#define CE_INDENTATION_STEP_BYTES 4
+
+static u8 data[70000];
+
+// NOTE: Blocks in use and spare, and line_blocks and indentation_tree
+s24 calculator_heap_bytes(void) {
+    return (program.line_blocks_count + program.free_line_blocks_count)*LINE_BLOCK_LINES*CE_LINEBREAK_BYTES +
+           program.line_blocks_capacity*(CE_LINE_BLOCK_BYTES + 2*CE_INDENTATION_STEP_BYTES);
+}
+
+void measure(const char *line, s24 size) {
+    s24 line_size = cast(s24)strlen(line);
+    for(s24 at = 0; at < size; ++at) {
+        data[at] = cast(u8)line[at % line_size];
+    }
+    host_create("BENCH", OS_TYPE_PRGM, data, size);
+
+    double started = bench_ns();
+    load_program("BENCH");
+    require_full_index();
+    double took = bench_ns() - started;
+    s24 lines = program.linebreaks_count;
+    s24 heap = calculator_heap_bytes();
+    printf("%-6s %6d %6d %6d %9d %10.2f %9.2f", line_size == 1 ? "\"\"" : "\"1\"", size, lines, program.line_blocks_capacity,
+           heap, cast(double)heap/lines, took/1e6);
+    bool loaded = editor.running;
+    close_undo_journal();
+
+    // NOTE: Half the heap the lines took
+    bench_heap_limit = bench_heap_bytes/2;
+    load_program("BENCH");
+    require_full_index();
+    bool stopped = !editor.running && editor.exit_message_at_end != null;
+    editor.running = true;
+    editor.exit_message_at_end = null;
+    bench_heap_limit = 0;
+    close_undo_journal();
+
+    // NOTE: No more heap than the lines took, then Enter at the start until the spare blocks run out
+    load_program("BENCH");
+    require_full_index();
+    bench_heap_limit = bench_heap_bytes;
+    s24 lines_were = program.linebreaks_count;
+    for(s24 i = 0; i < LINE_BLOCK_LINES*4 && program.notice == null; ++i) {
+        insert_token_u8(0, LINEBREAK);
+    }
+    bench_heap_limit = 0;
+    printf("   %-6s %-9s %d, %s\n", loaded ? "yes" : "no", stopped ? "message" : "NONE",
+           program.linebreaks_count - lines_were, program.notice ? program.notice : "NO NOTICE");
+    close_undo_journal();
+}
+
+int main(void) {
+    bench_start_editor();
+    printf("%-6s %6s %6s %6s %9s %10s %9s   %-6s %-9s %s\n", "line", "size", "lines", "table", "heap", "heap/line", "load ms",
+           "loaded", "half heap", "Enters, heap full");
+    measure("1\x3F", 2000);
+    measure("1\x3F", 20000);
+    measure("1\x3F", 33000);
+    measure("1\x3F", 65504);
+    measure("\x3F", 65505);
+    return 0;
+}
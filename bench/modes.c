@@ -0,0 +1,66 @@
+// NOTE: What SINGLE_BUFFERED trades: RAM for the program against VRAM, and frame times. Built once for each mode,
+// it loads a 40000 and a 65000 byte program and times full redraws, typing and scrolling a line at a time.
+// RAM is what the editor holds for the program: LoadedProgram, the most the heap ever held,
+// and the window appvar, which TI-OS keeps in RAM too.
+#include "bench.h"
+
+#define FRAMES (50)
+#define ROUNDS (5)
+
+// NOTE: The best of ROUNDS rounds of FRAMES frames, since PC timings are noisy
+double time_frames(void (*before_frame)(s24 frame)) {
+    double result = 1e18;
+    for(s24 round = 0; round < ROUNDS; ++round) {
+        double started = bench_ns();
+        for(s24 i = 0; i < FRAMES; ++i) {
+            before_frame(round*FRAMES + i);
+            render();
+            present_frame();
+        }
+        result = min(result, (bench_ns() - started)/FRAMES);
+    }
+    return result;
+}
+
+void redraw_all(s24 frame) {
+    I_KNOW_ITS_UNUSED(frame);
+    program.redraw_all = true;
+}
+void type_letter(s24 frame) {
+    insert_token_u8(program.cursor, cast(u8)('A' + frame % 26));
+    program.cursor += 1;
+}
+void move_down(s24 frame) {
+    I_KNOW_ITS_UNUSED(frame);
+    program.cursor = get_linebreak_location(calculate_cursor_y() + 1) + 1;
+}
+
+void measure(const char *name, s24 size) {
+    load_program((char*)name);
+    require_full_index();
+    program.cursor = get_linebreak_location(EDITOR_ROW_COUNT - 2) + 1;
+    render();
+    present_frame();
+    double full = time_frames(redraw_all);
+    double typing = time_frames(type_letter);
+    double scrolling = time_frames(move_down);
+    s24 window_appvar = max(0, host_var_size(PROGRAM_WINDOW_APPVAR_NAME, OS_TYPE_APPVAR));
+    printf("%6d %10d %10d %8d %12d %10.0f %10.0f %10.0f\n", size, cast(s24)sizeof(LoadedProgram),
+           cast(s24)bench_peak_heap_bytes, window_appvar, cast(s24)(sizeof(LoadedProgram) + bench_peak_heap_bytes) + window_appvar,
+           full, typing, scrolling);
+    save_program();
+    close_undo_journal();
+    close_program_window();
+}
+
+int main(void) {
+    bench_make_program("BENCH40", 40000, 0);
+    bench_make_program("BENCH65", 65000, 0);
+    bench_start_editor();
+    printf("SINGLE_BUFFERED %d, program.data holds %d bytes\n", SINGLE_BUFFERED, PROGRAM_DATA_SIZE);
+    printf("%6s %10s %10s %8s %12s %10s %10s %10s\n", "", "Loaded", "peak", "window", "RAM", "full", "typing", "scrolling");
+    printf("%6s %10s %10s %8s %12s %10s %10s %10s\n", "size", "Program", "heap", "appvar", "total", "ns/frame", "ns/frame", "ns/frame");
+    measure("BENCH40", 40000);
+    measure("BENCH65", 65000);
+    return 0;
+}
@@ -0,0 +1,56 @@
+// NOTE: Frame time of the editor view on a 40 KB program: a full redraw, and a frame after typing a letter.
+// Built a second time as render_before, from main.c as it was before the glyph atlas,
+// when every token string went through fontlib_DrawStringL.
+#include "bench.h"
+
+#define PROGRAM_SIZE (40000)
+#define FRAMES (50)
+
+typedef struct Counts {
+    double ns;
+    long fontlib_glyphs;
+    long blit_bytes;
+    long token_string_calls;
+} Counts;
+
+Counts counts_now(void) {
+    Counts result = { bench_ns(), host_glyphs, host_blit_bytes, host_token_string_calls };
+    return result;
+}
+
+void print_frames(const char *what, Counts started) {
+    Counts now = counts_now();
+    printf("%-14s %10.0f %10.1f %12.0f %10.1f\n", what, (now.ns - started.ns)/FRAMES,
+           cast(double)(now.fontlib_glyphs - started.fontlib_glyphs)/FRAMES,
+           cast(double)(now.blit_bytes - started.blit_bytes)/FRAMES,
+           cast(double)(now.token_string_calls - started.token_string_calls)/FRAMES);
+}
+
+int main(void) {
+    bench_make_program("BENCH", PROGRAM_SIZE, 0);
+    bench_start_editor();
+    load_program("BENCH");
+    program.cursor = get_linebreak_location(12) + 1;
+    render();
+    present_frame();
+
+    printf("%-14s %10s %10s %12s %10s\n", "", "ns/frame", "fontlib", "blit bytes", "OS token");
+    printf("%-14s %10s %10s %12s %10s\n", "", "", "glyphs", "", "strings");
+    Counts started = counts_now();
+    for(s24 i = 0; i < FRAMES; ++i) {
+        program.redraw_all = true;
+        render();
+        present_frame();
+    }
+    print_frames("full redraw", started);
+
+    started = counts_now();
+    for(s24 i = 0; i < FRAMES; ++i) {
+        insert_token_u8(program.cursor, cast(u8)('A' + i % 26));
+        program.cursor += 1;
+        render();
+        present_frame();
+    }
+    print_frames("typing", started);
+    return 0;
+}
@@ -0,0 +1,108 @@
+// NOTE: Replace all (2nd+Enter) with a few thousand matches, in programs that fit in program.data and ones that don't.
+// Every program is lines of letters with an X about every `every` tokens, and X is replaced with Y (same size),
+// YZ (growing) or nothing (shrinking), and once with too many matches to undo.
+// The result is checked against a copy replaced here, then undone and checked again.
+// "moved" is what memmove copied, "appvar" is what went into the window appvar.
+#include "bench.h"
+
+static u8 original[70000];
+static u8 expected[70000];
+
+s24 make_replace_program(s24 size, s24 every) {
+    s24 at = 0;
+    s24 matches = 0;
+    srand(1);
+    while(at < size) {
+        if(rand() % 30 == 0) {
+            original[at] = LINEBREAK;
+        } else if(rand() % every == 0) {
+            original[at] = 'X';
+            matches += 1;
+        } else {
+            original[at] = cast(u8)('A' + rand() % 23);
+        }
+        at += 1;
+    }
+    host_create("BENCH", OS_TYPE_PRGM, original, size);
+    return matches;
+}
+
+bool program_is(u8 *bytes, s24 size) {
+    bool result = program.size == size;
+    for(s24 i = 0; result && i < size; ++i) {
+        if(get_program_byte(i) != bytes[i]) { result = false; }
+    }
+    return result;
+}
+
+void time_replace(s24 size, s24 every, char *to) {
+    s24 matches = make_replace_program(size, every);
+    s24 to_count = cast(s24)strlen(to);
+    host_create(CLIPBOARD_APPVAR_NAME, OS_TYPE_APPVAR, to, to_count);
+    s24 expected_size = 0;
+    for(s24 i = 0; i < size; ++i) {
+        if(original[i] == 'X') {
+            memcpy(expected + expected_size, to, cast(size_t)to_count);
+            expected_size += to_count;
+        } else {
+            expected[expected_size++] = original[i];
+        }
+    }
+
+    load_program("BENCH");
+    require_full_index();
+    program.cursor = size / 2;
+    keep_program_window_around_cursor();
+    u8 x = 'X';
+    program.search_tokens[0] = x;
+    program.search_size = 1;
+    bool windowed = program.windowed;
+    long moved_was = bench_moved_bytes;
+    long written_was = host_written_bytes;
+    double started = bench_ns();
+    replace_all_matches();
+    double took = bench_ns() - started;
+    long moved = bench_moved_bytes - moved_was;
+    long written = host_written_bytes - written_was;
+
+    // NOTE: Drawing the notice, if there is one, has to stay on screen
+    int noclip_violations_were = host_noclip_violations;
+    render();
+    present_frame();
+    bool replaced = program.size == expected_size && program.notice == null;
+    char *result = program.notice ? program.notice : program_is(expected, expected_size) ? "ok" : "WRONG";
+    double undo_took = 0;
+    if(replaced) {
+        program.undo_merge_open = false;
+        started = bench_ns();
+        Delta *undo = pop_delta(&program.undo_buffer);
+        if(undo) {
+            apply_delta_to_program(undo, &program.redo_buffer);
+        }
+        undo_took = bench_ns() - started;
+        if(!program_is(original, size)) { result = "WRONG after undo"; }
+    }
+    if(host_noclip_violations != noclip_violations_were) { result = "drawn off screen"; }
+    printf("%6d %-3s %7d %-8s %9.2f %9.2f %9ld %9ld  %s\n", size, windowed ? "yes" : "no", matches, to[0] ? to : "nothing",
+           took/1e6, undo_took/1e6, moved, written, result);
+    program.search_size = 0;
+    close_undo_journal();
+    close_program_window();
+}
+
+int main(void) {
+    bench_start_editor();
+    printf("%6s %-3s %7s %-8s %9s %9s %9s %9s\n", "size", "win", "matches", "to", "ms", "undo ms", "moved", "appvar");
+    time_replace(40000, 12, "Y");
+    time_replace(40000, 12, "YZ");
+    time_replace(40000, 12, "");
+    time_replace(40000, 6, "Y");
+    time_replace(43000, 14, "YZ");
+    time_replace(50000, 16, "Y");
+    time_replace(50000, 16, "YZ");
+    time_replace(60000, 20, "YZ");
+    time_replace(65000, 20, "Y");
+    time_replace(65000, 20, "");
+    time_replace(65000, 20, "YZ");
+    return 0;
+}
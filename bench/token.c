@@ -0,0 +1,72 @@
+// NOTE: Token string lookups for every token of a 40 KB program, which is what render() and the width code do,
+// with the first byte table, the linear walk over token_string_ranges it replaced, and the OS.
+#include "bench.h"
+
+#define PROGRAM_SIZE (40000)
+#define PASSES (20)
+
+// NOTE: get_token_string_entry before token_string_first_range
+u24 get_token_string_entry_linear(u8 *token) {
+    u24 result = token[0];
+    for(u8 i = 0; i < ARRLEN(token_string_ranges); ++i) {
+        TokenStringRange *range = token_string_ranges + i;
+        if(range->prefix == token[0]) {
+            result = TOKEN_STRING_ENTRIES;
+            if(token[1] >= range->first && token[1] <= range->last) {
+                result = range->first_entry + cast(u24)(token[1] - range->first);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+int main(void) {
+    bench_make_program("BENCH", PROGRAM_SIZE, 0);
+    bench_start_editor();
+    load_program("BENCH");
+    s24 tokens = 0;
+    u24 checksum = 0;
+    for(s24 at = 0; at < program.size; at += get_token_size(at)) {
+        u8 *token = get_program_token_pointer(at);
+        if(get_token_string_entry(token) != get_token_string_entry_linear(token)) {
+            printf("entries differ at %d\n", at);
+            return 1;
+        }
+        tokens += 1;
+    }
+
+    double started = bench_ns();
+    for(s24 pass = 0; pass < PASSES; ++pass) {
+        for(s24 at = 0; at < program.size; at += get_token_size(at)) {
+            checksum += get_token_string_entry_linear(get_program_token_pointer(at));
+        }
+    }
+    double linear_ns = (bench_ns() - started)/(PASSES*tokens);
+
+    started = bench_ns();
+    for(s24 pass = 0; pass < PASSES; ++pass) {
+        for(s24 at = 0; at < program.size; at += get_token_size(at)) {
+            checksum += get_token_string_entry(get_program_token_pointer(at));
+        }
+    }
+    double table_ns = (bench_ns() - started)/(PASSES*tokens);
+
+    long os_calls_was = host_token_string_calls;
+    started = bench_ns();
+    for(s24 pass = 0; pass < PASSES; ++pass) {
+        for(s24 at = 0; at < program.size; at += get_token_size(at)) {
+            u24 length;
+            checksum += cast(u8)*get_token_string(get_program_token_pointer(at), &length) + length;
+        }
+    }
+    double cached_ns = (bench_ns() - started)/(PASSES*tokens);
+    long os_calls = host_token_string_calls - os_calls_was;
+
+    printf("%d tokens (checksum %u)\n", tokens, checksum);
+    printf("entry, linear walk      %6.1f ns/token\n", linear_ns);
+    printf("entry, first byte table %6.1f ns/token\n", table_ns);
+    printf("get_token_string        %6.1f ns/token, %.3f OS calls/token\n", cached_ns,
+           cast(double)os_calls/(PASSES*tokens));
+    return 0;
+}
@@ -6,10 +6,9 @@
 
     Performance
       - Rendering a whole screen full of glyphs takes a very long time (~200ms).
-        May be good to have a partial-renderer, or see if a bespoke font renderer
-        with few requirements will be faster.
-      - Being at the end of a very long line (See POKEWALRUS data files)
-        is just super laggy and that's dumb because the program shouldn't be laggy.
+        The editor view now only repaints the rows that changed, but scrolling a page,
+        theme changes and the first frame still pay for a full screen.
+        See if a bespoke font renderer with few requirements will be faster.
 
     ------Would be nice
 
@@ -22,16 +21,11 @@
       - Move static data (like the catalog menu data, and list of programs and lists)
         into appvars to free up more room for now...
         (A few kilobytes saved, and no longer statically limiting the number of programs/lists)
-      - Get a contiguous piece of memory 65505 bytes large.
-         - One candidate for this is reposessing GFX's draw-buffer,
-           and changing our renderer to accomodate not being double-buffered.
-           The plus is that this would kill two birds with one stone.
-           We can make the renderer better, and have enough memory for 65505 files
-      - Page memory in as we need it, and operate on one section of the file at a time
+      - Programs too big for program.data are windowed (see fit_program_window),
+        but moving the window far is slow. SINGLE_BUFFERED builds keep program.data in
+        GFX's back buffer instead, which fits any program, so this only matters without it.
 
     -----Various ideas
-      - adriweb: it's a nice ide feature to be able to list labels and instant-jump to them
-      - Maybe it'd be cool if you could goto any string.
       - User-space favorite tokens from catalog
       - Hotkey ideas
         - Delete from cursor to end of line
@@ -47,11 +41,14 @@
 #include <graphx.h>
 #include <fontlibc.h>
 #include <time.h>
+#include <string.h>
+#include <stdlib.h>
 #include <sys/timers.h>
 
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint24_t u24;
+typedef uint32_t u32;
 typedef int8_t s8;
 typedef int16_t s16;
 typedef int24_t s24;
@@ -66,17 +63,39 @@ typedef int s24;
 #define I_KNOW_ITS_UNUSED(var) ((void)(var))
 
 void copy(void *src, void *dest, s24 count);
+void copy_overlapping(void *src, void *dest, s24 count);
 void zero(void *dest, s24 count);
 int run_prgm_callback(void *data_, int retval);
 void update(void);
 void blit_loading_indicator(void);
 void render(void);
+void present_frame(void);
+void draw_profiler(void);
+void log_profile_frame(void);
 void load_program(char *name);
-void save_program(bool are_we_exiting_so_we_should_do_a_final_archiving_of_the_variable);
+void save_program(void);
+void mark_program_saved(void);
+bool save_program_slice(s24 max_bytes);
+void archive_program_if_it_was(void);
+void archive_undo_journal(void);
+void open_undo_journal(void);
+void close_undo_journal(void);
+void drop_stale_undo_journals(void);
+u16 update_checksum(u16 checksum, u8 *bytes, u24 count);
+bool page_in_undo_journal(void);
+void close_program_window(void);
+void index_program(s24 max_bytes);
+void require_full_index(void);
 void draw_string(char* str, u24 x, u8 y);
 void draw_string_max_chars(char* str, u24 max, u24 x, u8 y);
+void build_glyph_atlas(void);
+void build_token_string_cache(void);
+void update_glyph_colors(void);
 void update_input(void);
+bool any_key_held(void);
+bool any_key_pressed(void);
 u8 get_token_size(s24 position_in_program);
+u8 get_token_size_from_first_byte(u8 first_byte);
 typedef struct Range { s24 min; s24 max; } Range;
 Range get_selecting_range(void);
 s24 calculate_line_y(s24 token_offset);
@@ -123,15 +142,33 @@ const fontlib_font_t *editor_font = (fontlib_font_t*)editor_font_data;
 #define FONT_WIDTH 7
 #define FONT_HEIGHT 8
 
-#define ARRLEN(var) (sizeof((var)) / sizeof((var)[0]))
+// NOTE: Layout of the editor view. Row r of the text area starts at EDITOR_FIRST_ROW_Y + r*EDITOR_ROW_HEIGHT.
+// The last row is only partly on screen and only ever holds the end-of-program marker.
+#define EDITOR_FIRST_ROW_Y 5
+#define EDITOR_ROW_HEIGHT (FONT_HEIGHT + 2)
+#define EDITOR_ROW_COUNT 24
+#define EDITOR_TEXT_WIDTH (320 - (FONT_WIDTH + 2))
+#define EDITOR_SIDEBAR_X (EDITOR_TEXT_WIDTH + 1)
+#define EDITOR_CURSOR_GLYPH_X (320 - (FONT_WIDTH + 8))
+// NOTE: The rows the goto dialog covers, as a mask like FrameDamage.rows
+#define GOTO_DIALOG_ROWS (((cast(u32)1 << ((((120 + 22) - EDITOR_FIRST_ROW_Y) / EDITOR_ROW_HEIGHT) + 1)) - 1) & \
+                          ~((cast(u32)1 << (((120 - 22) - EDITOR_FIRST_ROW_Y) / EDITOR_ROW_HEIGHT)) - 1))
+
+// NOTE: When SINGLE_BUFFERED, render() draws straight to the screen and GFX's back buffer becomes program storage.
+// Its first ROW_STAGING_LINES lines are where rows of the text area get drawn before being copied
+// to the screen in one go, so the screen never shows a cleared or half drawn row.
+// The rest of it is PROGRAM_STORE, one contiguous piece of memory big enough for any program,
+// so the program window (get_cold_program_byte, fit_program_window, etc.) is never used.
+// Archiving can wipe VRAM, so while a program is loaded nothing gets archived, see archive_variable.
+// Otherwise render() draws to the back buffer and present_frame copies what changed to the screen.
+// bench/readme.md has what each costs.
+#ifndef SINGLE_BUFFERED
+    #define SINGLE_BUFFERED 0
+#endif
+#define ROW_STAGING_LINES EDITOR_ROW_HEIGHT
+#define PROGRAM_STORE (cast(u8*)gfx_vram + GFX_LCD_WIDTH*GFX_LCD_HEIGHT + GFX_LCD_WIDTH*ROW_STAGING_LINES)
 
-#define change_indentation_based_on_byte(indentation, byte) \
-    if(byte == 0xCF || (byte >= 0xD1 && byte <= 0xD3)) { \
-        indentation += 1; \
-    } else if(byte == 0xD4) { \
-        indentation -= 1; \
-        if(indentation < 0) { indentation = 0; } \
-    }
+#define ARRLEN(var) (sizeof((var)) / sizeof((var)[0]))
 
 typedef struct TokenList {
     char *name;
@@ -407,12 +444,16 @@ TokenDirectory directories[] = {
 
 #define Delta_InsertTokens 0
 #define Delta_RemoveTokens 1
+#define Delta_ReplaceTokens 2
 typedef u8 DeltaType;
 
 // NOTE: When Delta.type == Delta_RemoveTokens,
-// the structure is followed by Delta.remove_data.count bytes in memory
+// the structure is followed by Delta.remove_data.count bytes in memory.
+// When Delta.type == Delta_ReplaceTokens, it's followed by the from_count bytes that were replaced,
+// the to_count bytes they were replaced with and the gaps_size bytes of gaps between them, see replace_matches.
 typedef struct Delta {
     DeltaType type;
+    u16 previous; // NOTE: Offset of the delta pushed before this one, see DeltaCollection
     s24 cursor_was;
     union {
         struct { 
@@ -423,15 +464,31 @@ typedef struct Delta {
             s24 at;
             u16 count;
         } remove_data;
+        struct {
+            u8 from_count;
+            u8 to_count;
+            u16 gaps_size;
+        } replace_data;
     };
 } Delta;
 
+// NOTE: How many bytes of undo (and, separately, redo) history are kept. Offsets into it are stored in a u16.
+#define DELTA_COLLECTION_SIZE 4096
+
 typedef struct DeltaCollection {
-    // NOTE: This is an array where the first element is the oldest undo.
-    // Newest undos are put towards the top.
-    u8 data[4096];
-    u24 data_size;
+    // NOTE: This is a circular log. The oldest delta starts at tail, the newest one at newest,
+    // and the next one goes at head. Deltas are never split across the end of data: when one doesn't
+    // fit before the end it starts over at 0, and wrap_at remembers where the deltas before it stopped.
+    // Each delta remembers where the one before it is, so popping doesn't have to walk from the tail.
+    u8 data[DELTA_COLLECTION_SIZE];
+    u24 tail;
+    u24 head;
+    u24 newest;
+    u24 wrap_at;
+    bool wrapped; // NOTE: True when the deltas go tail..wrap_at, then 0..head
     u24 delta_count;
+    // NOTE: If set, evicted deltas are appended to the undo journal instead of being lost
+    bool spills_to_journal;
 } DeltaCollection;
 
 u24 size_of_delta(Delta *delta) {
@@ -440,51 +497,135 @@ u24 size_of_delta(Delta *delta) {
         result = sizeof(Delta);    
     } else if(delta->type == Delta_RemoveTokens) {
         result = sizeof(Delta) + cast(u24)delta->remove_data.count;
+    } else if(delta->type == Delta_ReplaceTokens) {
+        result = sizeof(Delta) + cast(u24)delta->replace_data.from_count + delta->replace_data.to_count + delta->replace_data.gaps_size;
     } else { assert(false, "Delta with invalid type of %d\n", delta->type); }
     return result;
 }
 
 void clear_delta_collection(DeltaCollection *collection) {
-    collection->data_size = 0;
+    // NOTE: Doesn't touch spills_to_journal
+    collection->tail = 0;
+    collection->head = 0;
+    collection->newest = 0;
+    collection->wrap_at = 0;
+    collection->wrapped = false;
     collection->delta_count = 0;
 }
 
+// NOTE: Offset of the delta after the one at offset, going from oldest to newest.
+u24 next_delta_offset(DeltaCollection *collection, u24 offset) {
+    u24 result = offset + size_of_delta(cast(Delta*)(collection->data + offset));
+    if(collection->wrapped && result == collection->wrap_at) {
+        result = 0;
+    }
+    return result;
+}
+
+void evict_oldest_delta(DeltaCollection *collection) {
+    assert(collection->delta_count > 0, "Nothing to evict");
+    collection->delta_count -= 1;
+    if(collection->delta_count == 0) {
+        clear_delta_collection(collection);
+    } else {
+        u24 next = next_delta_offset(collection, collection->tail);
+        if(next == 0) {
+            collection->wrapped = false;
+        }
+        collection->tail = next;
+    }
+}
+
+void spill_delta_to_undo_journal(u8 *journal, Delta *delta); // NOTE: Forward declared, it needs `program`
+void empty_undo_journal(void);
+
 // NOTE: May return null if no room to add the delta
 // data_size indicates how much data is copied from void *data.
 // push_size indicates how much room is added to collection's array for the result.
+// Makes room by evicting the oldest deltas.
 Delta* push_delta(DeltaCollection *collection, void *data, u24 data_size, u24 push_size) {
     Delta *result = 0;
     if(push_size <= ARRLEN(collection->data)) {
-        while(collection->data_size + push_size > ARRLEN(collection->data)) {
-            u24 to_free = size_of_delta((Delta*)&collection->data[0]);
-            u24 remaining = collection->data_size - to_free;
-            copy(collection->data + to_free, collection->data, (s24)remaining);
-            collection->data_size = remaining;
-            collection->delta_count -= 1;
-        }
-        result = cast(Delta*)(collection->data + collection->data_size);
+        u24 at;
+        u8 journal = 0;
+        while(true) {
+            if(collection->delta_count == 0) {
+                clear_delta_collection(collection);
+                at = 0;
+                break;
+            }
+            if(collection->wrapped) {
+                if(collection->head + push_size <= collection->tail) {
+                    at = collection->head;
+                    break;
+                }
+            } else {
+                if(collection->head + push_size <= ARRLEN(collection->data)) {
+                    at = collection->head;
+                    break;
+                }
+                if(push_size <= collection->tail) {
+                    collection->wrapped = true;
+                    collection->wrap_at = collection->head;
+                    at = 0;
+                    break;
+                }
+            }
+            if(collection->spills_to_journal) {
+                spill_delta_to_undo_journal(&journal, cast(Delta*)(collection->data + collection->tail));
+            }
+            evict_oldest_delta(collection);
+        }
+        if(journal) {
+            ti_Close(journal);
+        }
+        result = cast(Delta*)(collection->data + at);
         copy(data, result, cast(s24)data_size);
-        collection->data_size += push_size;
+        result->previous = cast(u16)collection->newest;
+        collection->newest = at;
+        collection->head = at + push_size;
         collection->delta_count += 1;
+    } else {
+        // NOTE: The edit can't be undone, and the deltas before it would undo into a program that isn't there anymore
+        clear_delta_collection(collection);
+        if(collection->spills_to_journal) {
+            empty_undo_journal();
+        }
     }
     return result;
 }
 
-// NOTE: Returns null if nothing to pop
+// NOTE: Makes the newest delta extra bytes bigger, if that fits right after it without evicting anything.
+// Returns the newest delta, or null if it didn't fit.
+Delta* grow_newest_delta(DeltaCollection *collection, u24 extra) {
+    Delta *result = 0;
+    if(collection->delta_count > 0) {
+        u24 limit = collection->wrapped ? collection->tail : ARRLEN(collection->data);
+        if(collection->head + extra <= limit) {
+            collection->head += extra;
+            result = cast(Delta*)(collection->data + collection->newest);
+        }
+    }
+    return result;
+}
+
+// NOTE: Returns null if nothing to pop.
+// The result stays valid until the next push into the same collection.
 Delta* pop_delta(DeltaCollection *collection) {
     Delta *result = 0;
     if(collection->delta_count > 0) {
-        result = cast(Delta*)collection->data;
-        u24 i;
-        for(i = 0; i < collection->delta_count; ++i) {
-            if(i == collection->delta_count - 1) {
-                break;
+        result = cast(Delta*)(collection->data + collection->newest);
+        collection->delta_count -= 1;
+        if(collection->delta_count == 0) {
+            clear_delta_collection(collection);
+        } else {
+            collection->head = collection->newest;
+            if(collection->wrapped && collection->head == 0) {
+                collection->wrapped = false;
+                collection->head = collection->wrap_at;
             }
-            result = cast(Delta*)((cast(u8*)result) + size_of_delta(result));
+            collection->newest = result->previous;
         }
-        assert(i == collection->delta_count - 1, "Should just be true");
-        collection->delta_count -= 1;
-        collection->data_size -= size_of_delta(result);
     }
     return result;
 }
@@ -514,6 +655,26 @@ void push_remove_delta(DeltaCollection *collection, s24 cursor_was, s24 removed_
     }
 }
 
+// NOTE: gaps may be null, then the caller writes them into the result
+Delta* push_replace_delta(DeltaCollection *collection, s24 cursor_was, u8 *from, u8 from_count, u8 *to, u8 to_count, u8 *gaps, u16 gaps_size) {
+    Delta delta;
+    delta.type = Delta_ReplaceTokens;
+    delta.cursor_was = cursor_was;
+    delta.replace_data.from_count = from_count;
+    delta.replace_data.to_count = to_count;
+    delta.replace_data.gaps_size = gaps_size;
+    Delta *placed_at = push_delta(collection, &delta, sizeof(Delta), size_of_delta(&delta));
+    if(placed_at) {
+        u8 *data_goes_at = (cast(u8*)placed_at) + sizeof(Delta);
+        copy(from, data_goes_at, from_count);
+        copy(to, data_goes_at + from_count, to_count);
+        if(gaps) {
+            copy(gaps, data_goes_at + from_count + to_count, gaps_size);
+        }
+    }
+    return placed_at;
+}
+
 typedef enum CursorMode {
     CursorMode_Normal,
     CursorMode_Second,
@@ -524,29 +685,160 @@ typedef struct Linebreak {
     // NOTE: Use get_linebreak_location to read linebreak location, because
     // we want the 0th one to always be -1, but we want to be able to store
     // a u16 from 0-65535, and we want to save storage space
+    // Relative to the base of its LineBlock.
     u16 location_;
+    // NOTE: What the line was last drawn with. get_line_indentation has the real one.
     u8 indentation;
+    // NOTE: The line's IndentationStep, packed by pack_indentation_step
+    u8 indentation_step;
+    // NOTE: How many characters the line after this linebreak takes up on screen, not counting indentation.
+    // LINE_WIDTH_UNKNOWN until something asks for it with get_line_width.
+    u16 width;
 } Linebreak;
+#define LINE_WIDTH_UNKNOWN 0xFFFF
+
+typedef struct LineBlock {
+    Linebreak *lines; // NOTE: Room for LINE_BLOCK_LINES, from the heap
+    s24 first_line;
+    // NOTE: Where the linebreak of the first line is, except block 0 which starts with line 0 and has 0.
+    s24 base;
+    u8 count;
+} LineBlock;
+
+// NOTE: On long lines, every LINE_CHECKPOINT_SPACING tokens we remember the column the token starts at,
+// so finding a column or an offset in the line only walks the tokens after the closest checkpoint.
+typedef struct LineCheckpoint {
+    u16 offset;
+    u16 column; // NOTE: Not counting indentation
+} LineCheckpoint;
+#define LINE_CHECKPOINT_SPACING 32
+
+// NOTE: Takes the indentation before a line to max(indentation + change, floor) after it.
+// Then, End and friends at the start or end of a line each work like that, and so does
+// anything made of lines one after another (see chain_indentation_steps).
+typedef struct IndentationStep {
+    s16 change;
+    u16 floor;
+} IndentationStep;
+
+typedef enum ProgramSort {
+    ProgramSort_Name,
+    ProgramSort_Size,
+} ProgramSort;
 
 typedef struct LoadedProgram {
     bool program_loaded;
     u8 program_name[9]; // NOTE: Null terminated. Max 8 chars.
     s24 view_top_program;
     s24 selected_program;
+    ProgramSort program_sort;
     bool archived;
-
-    // #define PROGRAM_DATA_SIZE OS_VAR_MAX_SIZE
-    #define PROGRAM_DATA_SIZE 44000
-    u8 data[PROGRAM_DATA_SIZE];
+    // NOTE: Set on exit once nothing reads data anymore, see archive_variable
+    bool data_released;
+
+    // NOTE: data is a gap buffer. Bytes before the gap sit at the start of the array,
+    // bytes after the gap sit at the end of the array, and inserting/removing
+    // at the gap only touches the edited bytes. Moving the gap costs the distance moved.
+    // Don't index it directly. Use get_program_byte, move_program_gap, etc.
+    //
+    // Programs that don't fit are windowed: data holds the window_start.. part of the program,
+    // and the cold_after bytes after the window are kept in the PROGRAM_WINDOW_APPVAR_NAME appvar
+    // together with the window_start bytes before it. See fit_program_window.
+    #define PROGRAM_MAX_SIZE 65505 // NOTE: Biggest program TI-OS lets you make
+    // NOTE: One extra byte that is always 0, so reading the byte under a cursor
+    // at the very end of the program (get_token_size, etc.) stays in bounds.
+#if SINGLE_BUFFERED
+    // NOTE: Bigger than PROGRAM_MAX_SIZE, so programs never need the window
+    #define PROGRAM_DATA_SIZE (GFX_LCD_WIDTH*(GFX_LCD_HEIGHT - ROW_STAGING_LINES) - 1)
+    u8 *data; // NOTE: PROGRAM_STORE, set by load_program
+#else
+    #define PROGRAM_DATA_SIZE 43744
+    u8 data[PROGRAM_DATA_SIZE + 1];
+#endif
     s24 size;
-    
-    // 4800 bytes
-    Linebreak linebreaks[1600];
+    // NOTE: gap_start is both a position in the window and an index into data.
+    // gap_end is an index into data, one past the end of the gap.
+    s24 gap_start;
+    s24 gap_end;
+    s24 window_start;
+    s24 cold_after;
+    bool windowed; // NOTE: True once the appvar for the cold bytes exists
+    // NOTE: Reading a cold byte reads the COLD_PAGE_SIZE bytes of the appvar around it into cold_page.
+    // cold_page_start is an offset into the appvar, -1 if cold_page holds nothing.
+    #define COLD_PAGE_SIZE 256
+    u8 cold_page[COLD_PAGE_SIZE];
+    s24 cold_page_start;
+
+    // NOTE: The linebreaks are kept in blocks of up to LINE_BLOCK_LINES, which are taken from the heap as
+    // the program needs them. Adding or removing linebreaks only shifts the ones in their block, and moving
+    // the ones after them only moves the bases of the blocks after. Use get_linebreak and get_linebreak_location.
+    // line_blocks is from the heap too, and doubles when it runs out of room (see grow_line_blocks),
+    // so the number of lines is only limited by the heap. A full block and its place in line_blocks and
+    // indentation_tree take LINE_BLOCK_HEAP_BYTES, about 6.5 bytes a line (see bench/lines.c).
+    #define LINE_BLOCK_LINES 64
+    #define LINE_BLOCK_HEAP_BYTES (sizeof(Linebreak)*LINE_BLOCK_LINES + sizeof(LineBlock) + 2*sizeof(IndentationStep))
+    #define LINE_BLOCKS_MIN 16
+    LineBlock *line_blocks;
+    s24 line_blocks_capacity; // NOTE: A power of 2, see indentation_tree
+    s24 line_blocks_count;
+    // NOTE: The block the last line looked up was in. Lines are mostly looked up next to the last one.
+    s24 line_block_cache;
+    // NOTE: Blocks that aren't in use, linked through their first bytes. See reserve_linebreaks.
+    Linebreak *free_line_blocks;
+    s24 free_line_blocks_count;
     s24 linebreaks_count;
 
-    u16 linebreaks_dirty_indentation_min;
+    // NOTE: Sorted by offset. Edits shift them like linebreaks. Lines that get linebreaks added or
+    // removed lose theirs, and any line gets (re)indexed when a walk through it goes too long.
+    LineCheckpoint line_checkpoints[1024];
+    s24 line_checkpoints_count;
+
+    // NOTE: A segment tree of IndentationSteps over the line blocks, so the indentation of any line is a walk
+    // down the tree plus the lines before it in its block, however far away the last edit was.
+    // indentation_tree[1] is every line, the children of i are 2i and 2i + 1, and block b is at line_blocks_capacity + b.
+    // It has line_blocks_capacity*2 nodes, from the heap along with line_blocks.
+    IndentationStep *indentation_tree;
+
+    // NOTE: Every edit bumps edit_generation, and the program variable holds the program as it was at
+    // saved_generation. Since then, the first unchanged_prefix bytes and last unchanged_suffix bytes
+    // are still the same as in the variable (they overlap when nothing changed), so save_program only
+    // writes what's between them. save_needs_full_write is for when the variable isn't ours to patch.
+    u24 edit_generation;
+    u24 saved_generation;
+    s24 unchanged_prefix;
+    s24 unchanged_suffix;
+    bool save_needs_full_write;
+    // NOTE: True while the main loop is saving a slice at a time, see save_program_slice
+    bool autosaving;
+
+    // NOTE: load_program only finds the linebreaks of the first screen (see index_program_through_line),
+    // the rest are found a slice at a time between frames. Tokens before indexed_until have been looked at.
+    // Until fully_indexed, the last line in
+    // linebreaks may go on past indexed_until, so it must stay off screen and nothing may edit the program.
+    // Use require_full_index when something needs all of it.
+    #define PROGRAM_INDEX_SLICE_BYTES 2048
+    // NOTE: The main loop also indexes in the time idle frames leave, in slices that take about this long,
+    // so the next frame or input tick isn't overrun. See the profiler's index row.
+    #define PROGRAM_IDLE_INDEX_SLICE_BYTES 512
+    #define PROGRAM_IDLE_INDEX_SLICE_CLOCK_CYCLES (CLOCKS_PER_SEC / 200)
+    s24 indexed_until;
+    bool fully_indexed;
+
+    // NOTE: Where the Lbl tokens are, sorted and kept in step with edits like linebreaks, so goto doesn't
+    // have to walk the program. labels_by_name holds indices into labels sorted by name and then offset,
+    // and is sorted again when goto needs it after labels came or went or a label's name was edited.
+    // Programs with more than LABELS_MAX labels only have the first ones here and goto walks the program.
+    #define LABELS_MAX 512
+    u16 labels[LABELS_MAX];
+    s24 labels_count;
+    bool labels_overflowed;
+    u16 labels_by_name[LABELS_MAX];
+    bool labels_by_name_dirty;
 
     s24 cursor;
+    // NOTE: Line the cursor was on last time calculate_cursor_y ran.
+    // Kept in step when linebreaks are added or removed above it.
+    s24 cursor_y_cache;
     bool cursor_selecting;
     s24 cursor_started_selecting;
 
@@ -560,14 +852,64 @@ typedef struct LoadedProgram {
 
     DeltaCollection undo_buffer;
     DeltaCollection redo_buffer;
+    // NOTE: True while the newest undo delta is from a keystroke that the next keystroke may be merged into
+    bool undo_merge_open;
+    u24 undo_merge_clock;
+    // NOTE: How many deltas older than the ones in undo_buffer are in the undo journal appvar
+    u24 undo_journal_count;
+    char undo_journal_name[9];
+    // NOTE: Checksum of the program as it was read, to tell whether its undo journal is still about it
+    u16 loaded_checksum;
 
     bool entering_goto;
     u8 entering_goto_chars[2];
     u8 entering_goto_chars_count;
 
+    // NOTE: The tokens 2nd+Up/Down search for, see search_from_cursor. Never has a linebreak.
+    // Every match on screen is highlighted until 2nd+Clear forgets them.
+    #define SEARCH_MAX_BYTES 32
+    u8 search_tokens[SEARCH_MAX_BYTES];
+    s24 search_size;
+
+    // NOTE: The list of labels, opened with 2nd+[X,T,θ,n]. Indices into labels.
+    bool browsing_labels;
+    s24 label_browser_index;
+    s24 label_browser_view_top;
+
     // NOTE: If this is a lot, then we reduce the max width to keep the program running smoothly
     u16 rendered_token_count_last_frame;
 
+    // NOTE: Says why an edit didn't happen (or only partly did), in a box where the goto dialog goes,
+    // until the next key goes down
+    char *notice;
+
+    // NOTE: The draw buffer is kept between frames and only the parts that changed get repainted.
+    // Lines between dirty_line_min and dirty_line_max (inclusive) have to be repainted next frame,
+    // the drawn_ fields are what the buffer showed last frame, and redraw_all throws all of it away.
+    #define LAST_LINE_POSSIBLE 0x7FFFFF
+    bool redraw_all;
+    bool drawn_editor_view;
+    s24 dirty_line_min;
+    s24 dirty_line_max;
+    s24 drawn_view_top_line;
+    s24 drawn_view_first_character;
+    s24 drawn_cursor;
+    s24 drawn_cursor_y;
+    bool drawn_cursor_selecting;
+    s24 drawn_cursor_started_selecting;
+    s24 drawn_highlight_min_line;
+    s24 drawn_highlight_max_line;
+    CursorMode drawn_cursor_mode;
+    bool drawn_alpha_is_lowercase;
+    bool drawn_entering_goto;
+    char *drawn_notice;
+    // NOTE: The program list, token directory and label list are only drawn again when one of these changes
+    bool drawn_menu;
+    TokenDirectory *drawn_directory;
+    bool drawn_browsing_labels;
+    s24 drawn_menu_list_index;
+    s24 drawn_menu_selection;
+
     // NOTE: Null if closed. If `opened_directory.name == "EXEC"`
     // then we have some hardcoded overrides to match TI-OS's functionality
     TokenDirectory *opened_directory;
@@ -577,6 +919,7 @@ typedef struct LoadedProgram {
 } LoadedProgram;
 
 #define CLIPBOARD_APPVAR_NAME "AETHRCLP"
+#define UNDO_JOURNAL_APPVAR_PREFIX "AETHU"
 #define SETTINGS_DATA_APPVAR_NAME "AETHRDAT"
 typedef struct EditorSettings {
     // NOTE: When I change the settings struct,
@@ -605,58 +948,262 @@ typedef struct Editor {
     u8 background_color;
     u8 foreground_color;
     u8 highlight_color;
+
+    // NOTE: Frames only run render() when this is set (or program.redraw_all is).
+    // Set by input ticks that ran update(), indexing, and bars that are still animating.
+    bool render_requested;
 } Editor;
 
 static LoadedProgram program = {};
 static Editor editor = {};
 
+// NOTE: What render() changed in the draw buffer this frame, so present_frame only copies that to the screen.
+// Bit r of rows is row r of the editor text area.
+typedef struct FrameDamage {
+    bool everything;
+    bool text_area;
+    bool sidebar;
+    bool cursor_glyph;
+    bool profiler;
+    u32 rows;
+} FrameDamage;
+static FrameDamage frame_damage = {};
+
+// NOTE: How long each part of a frame took, in clock() ticks, over the last PROFILE_SAMPLES times it ran.
+// Kept outside LoadedProgram so load_program doesn't wipe it, and so the load itself can be recorded.
+typedef enum ProfilePhase {
+    ProfilePhase_Input,
+    ProfilePhase_Update,
+    ProfilePhase_Latency,
+    ProfilePhase_Render,
+    ProfilePhase_Present,
+    ProfilePhase_Index,
+    ProfilePhase_Frame,
+    ProfilePhase_Save,
+    ProfilePhase_Autosave,
+    ProfilePhase_Load,
+    ProfilePhase_Count,
+} ProfilePhase;
+static char *profile_phase_names[ProfilePhase_Count] = {
+    "input", "update", "latency", "render", "present", "index", "frame", "save", "autosave", "load",
+};
+typedef struct Profiler {
+    #define PROFILE_SAMPLES 16
+    u24 samples[ProfilePhase_Count][PROFILE_SAMPLES];
+    u8 samples_count[ProfilePhase_Count];
+    u8 next_sample[ProfilePhase_Count];
+    // NOTE: Toggled with 2nd+On. Also what turns the DEBUG per-frame log on, so it doesn't flood the console.
+    bool visible;
+    // NOTE: Where draw_profiler puts the box, in the bottom right of the text area
+    #define PROFILER_COLUMNS 26
+    #define PROFILER_WIDTH (PROFILER_COLUMNS*FONT_WIDTH + 4)
+    #define PROFILER_HEIGHT ((ProfilePhase_Count + 1)*EDITOR_ROW_HEIGHT + 2)
+    #define PROFILER_X (EDITOR_SIDEBAR_X - PROFILER_WIDTH - 2)
+    #define PROFILER_Y (240 - PROFILER_HEIGHT - 2)
+    u24 frames;
+    // NOTE: Bit p is set when phase p was recorded since the frame began, for the DEBUG log
+    u16 ran_this_frame;
+} Profiler;
+static Profiler profiler = {};
+// NOTE: Records that phase took from started_clock until now, and returns now so the next phase can start from it.
+u24 end_profile_phase(ProfilePhase phase, u24 started_clock) {
+    u24 now = cast(u24)clock();
+    profiler.samples[phase][profiler.next_sample[phase]] = now - started_clock;
+    profiler.next_sample[phase] = (profiler.next_sample[phase] + 1) % PROFILE_SAMPLES;
+    if(profiler.samples_count[phase] < PROFILE_SAMPLES) {
+        profiler.samples_count[phase] += 1;
+    }
+    profiler.ran_this_frame |= cast(u16)(1 << phase);
+    return now;
+}
+
 // 2500 bytes
 typedef struct OS_Program {
     // NOTE: Not null terminated
     u8 name[8];
+    // NOTE: Read by load_program_info on every start and kept in the catalog, and kept up to date
+    // by mark_program_saved, so the program selector doesn't have to open every variable it draws.
+    u16 size;
+    bool archived;
 } OS_Program;
-OS_Program os_programs[312];
-s24        os_programs_count;
+OS_Program *os_programs;
+s24         os_programs_count;
 
 typedef struct OS_List {
     // NOTE: Not null terminated
     u8 name[5];
 } OS_List;
-OS_List os_lists[64];
-s24     os_lists_count;
+OS_List *os_lists;
+s24      os_lists_count;
+
+// NOTE: os_programs and os_lists are as big as the VAT needs and sorted by name. Sorting hundreds of names
+// takes a while, so the sorted lists are kept in the CATALOG_APPVAR_NAME appvar with a fingerprint of the
+// names in the VAT they were sorted from. Walking the VAT for the fingerprint is quick, and if no variable
+// was added, removed or renamed since, the sorted names are read back instead of being sorted again.
+// Program sizes and archive status are kept with the names, but TI-OS can change them without touching the
+// names, so they're read again on every start, and the catalog is written again on exit if any changed.
+#define CATALOG_APPVAR_NAME "AETHRCAT"
+#define CATALOG_VERSION 2
+u32 os_programs_fingerprint;
+u32 os_lists_fingerprint;
+bool catalog_changed;
+
+typedef struct CatalogHeader {
+    u8 version;
+    u24 programs_count;
+    u32 programs_fingerprint;
+    u24 lists_count;
+    u32 lists_fingerprint;
+} CatalogHeader;
+
+// NOTE: Walks the VAT for the programs or lists the editor shows, counts them and fingerprints their names.
+// If records isn't null, their names are copied into the start of each record, and the records are zero filled.
+s24 scan_vat(u8 type, u8 *records, u24 stride, u8 name_size, u32 *fingerprint) {
+    s24 result = 0;
+    u32 hash = 2166136261; // NOTE: FNV-1a
+    void *it = null;
+    while(true) {
+        char *name = ti_DetectVar(&it, null, type);
+        if(!name) {
+            break;
+        }
+        bool name_valid;
+        if(type == OS_TYPE_PRGM) {
+            name_valid = (name[0] != '!' && name[0] != '#');
+        } else {
+            // NOTE: Lists start with 0x5D no matter what, and we don't care.
+            name += 1;
+            name_valid = !(name[1] >= 0 && name[1] <= 5);
+        }
+        if(name_valid) {
+            for(u8 i = 0; i < name_size && name[i] != 0; ++i) {
+                hash = (hash ^ cast(u8)name[i]) * 16777619;
+            }
+            hash = (hash ^ 0) * 16777619;
+            if(records) {
+                u8 *dest = records + cast(u24)result*stride;
+                zero(dest, stride);
+                for(u8 i = 0; i < name_size && name[i] != 0; ++i) {
+                    dest[i] = cast(u8)name[i];
+                }
+                log(type == OS_TYPE_PRGM ? "Loading program %s\n" : "Loading list %s\n", name);
+            }
+            result += 1;
+        }
+    }
+    *fingerprint = hash;
+    return result;
+}
 
-u24 alphabetical_sort_cost(char *name) {
-    // NOTE: We sort by the first 4 letters.
-    u24 result = 0;
-    u24 magnitude = 26*26*26*26;
+// NOTE: Letters are compared without case, like TI-OS's program list does
+s24 compare_catalog_names(u8 *a, u8 *b, u8 name_size) {
+    s24 result = 0;
+    for(u8 i = 0; i < name_size && result == 0; ++i) {
+        u8 a_letter = (a[i] >= 'a' && a[i] <= 'z') ? cast(u8)(a[i] - 'a' + 'A') : a[i];
+        u8 b_letter = (b[i] >= 'a' && b[i] <= 'z') ? cast(u8)(b[i] - 'a' + 'A') : b[i];
+        result = cast(s24)a_letter - cast(s24)b_letter;
+        if(a[i] == 0) {
+            break;
+        }
+    }
+    return result;
+}
 
-    for(int l = 0; l <= (4 - 1) && name[l] != 0; ++l) {
-        u8 letter_index;
-        if(name[l] >= 'A' && name[l] <= 'Z') letter_index = (u8)(name[l] - 'A');
-        else if(name[l] >= 'a' && name[l] <= 'z') letter_index = (u8)(name[l] - 'a');
-        else letter_index = 0;
-        result += letter_index*magnitude;
-        magnitude = magnitude / 26;
+s24 compare_program_names(u8 *a, u8 *b) { return compare_catalog_names(a, b, sizeof(os_programs->name)); }
+s24 compare_list_names(u8 *a, u8 *b) { return compare_catalog_names(a, b, sizeof(os_lists->name)); }
+// NOTE: Biggest first, and by name when they're the same size
+s24 compare_program_sizes(u8 *a, u8 *b) {
+    s24 result = cast(s24)(cast(OS_Program*)b)->size - cast(s24)(cast(OS_Program*)a)->size;
+    if(result == 0) {
+        result = compare_program_names(a, b);
     }
     return result;
 }
 
-typedef struct RunPrgmCallbackReconstructProgram {
-    u8 program_name[9];
-    s24 cursor;
-    s24 view_top_line;
-} RunPrgmCallbackReconstructProgram;
+void swap_catalog_records(u8 *a, u8 *b, u24 stride) {
+    for(u24 i = 0; i < stride; ++i) {
+        u8 swap = a[i];
+        a[i] = b[i];
+        b[i] = swap;
+    }
+}
 
-u8 key_down[8];
-u8 key_held[8];
-u8 key_up[8];
-u8 key_debounced[8];
-u8 key_timers[8][8];
-bool on_pressed;
-bool on_held;
+void sift_down_catalog_record(u8 *records, u24 stride, s24 root, s24 count, s24 (*compare)(u8 *a, u8 *b)) {
+    while(root*2 + 1 <= count - 1) {
+        s24 child = root*2 + 1;
+        if(child + 1 <= count - 1 && compare(records + cast(u24)child*stride, records + cast(u24)(child + 1)*stride) < 0) {
+            child += 1;
+        }
+        if(compare(records + cast(u24)root*stride, records + cast(u24)child*stride) >= 0) {
+            break;
+        }
+        swap_catalog_records(records + cast(u24)root*stride, records + cast(u24)child*stride, stride);
+        root = child;
+    }
+}
+
+// NOTE: Heapsort, so it needs no memory and never takes more than n log n steps
+void sort_catalog(u8 *records, u24 stride, s24 count, s24 (*compare)(u8 *a, u8 *b)) {
+    for(s24 root = count/2 - 1; root >= 0; --root) {
+        sift_down_catalog_record(records, stride, root, count, compare);
+    }
+    for(s24 end = count - 1; end >= 1; --end) {
+        swap_catalog_records(records, records + cast(u24)end*stride, stride);
+        sift_down_catalog_record(records, stride, 0, end, compare);
+    }
+}
+
+// NOTE: Keeps the same program selected
+void sort_programs(ProgramSort sort) {
+    OS_Program selected = {};
+    if(program.selected_program >= 0 && program.selected_program <= os_programs_count - 1) {
+        selected = os_programs[program.selected_program];
+    }
+    sort_catalog(cast(u8*)os_programs, sizeof(OS_Program), os_programs_count,
+                 sort == ProgramSort_Size ? compare_program_sizes : compare_program_names);
+    program.program_sort = sort;
+    for(s24 i = 0; i <= os_programs_count - 1; ++i) {
+        if(memcmp(os_programs[i].name, selected.name, sizeof(selected.name)) == 0) {
+            program.selected_program = i;
+            break;
+        }
+    }
+    program.view_top_program = max(0, program.selected_program - 11);
+    program.redraw_all = true;
+}
+
+// NOTE: Returns whether any size or archive status was different
+bool load_program_info(void) {
+    bool result = false;
+    for(s24 i = 0; i <= os_programs_count - 1; ++i) {
+        char name[9] = {};
+        memcpy(name, os_programs[i].name, sizeof(os_programs[i].name));
+        u8 handle = ti_OpenVar(name, "r", OS_TYPE_PRGM);
+        u16 size = 0;
+        bool archived = false;
+        if(handle) {
+            size = ti_GetSize(handle);
+            archived = (ti_IsArchived(handle) != 0);
+            ti_Close(handle);
+        }
+        if(os_programs[i].size != size || os_programs[i].archived != archived) {
+            os_programs[i].size = size;
+            os_programs[i].archived = archived;
+            result = true;
+        }
+    }
+    return result;
+}
+
+// NOTE: Archiving may garbage collect, and gc_after starts GFX over, which wipes VRAM. With SINGLE_BUFFERED,
+// that's where program.data is, so nothing is archived while a program is loaded until main is done with it on exit.
+void archive_variable(u8 handle) {
+    bool may_wipe_program = SINGLE_BUFFERED && program.program_loaded && !program.data_released;
+    if(!may_wipe_program && ti_ArchiveHasRoomVar(handle)) {
+        ti_SetArchiveStatus(true, handle);
+    }
+}
 
-void gc_before() { gfx_End(); }
-void gc_after() { gfx_Begin(); }
 void exit_with_message(char *message) {
     editor.running = false;
     editor.exit_message_at_end = message;
@@ -671,6 +1218,7 @@ void update_editor_theme_based_on_settings() {
         editor.foreground_color = 0x00;
         editor.highlight_color = 0xF7;
     }
+    update_glyph_colors();
 }
 
 bool gfx_begun = false;
@@ -681,17 +1229,124 @@ void initialize_graphics() {
     if(!gfx_begun) {
         gfx_begun = true;
         gfx_Begin();
+#if SINGLE_BUFFERED
+        gfx_SetDrawScreen();
+        gfx_FillScreen(0xFF);
+#else
         gfx_SetDrawBuffer();
         gfx_FillScreen(0xFF);
         gfx_SwapDraw();
+#endif
+    }
+}
+
+// NOTE: os_programs has to be sorted by name
+void write_catalog(void) {
+    u8 handle = ti_Open(CATALOG_APPVAR_NAME, "w");
+    if(handle) {
+        CatalogHeader header;
+        header.version = CATALOG_VERSION;
+        header.programs_count = cast(u24)os_programs_count;
+        header.programs_fingerprint = os_programs_fingerprint;
+        header.lists_count = cast(u24)os_lists_count;
+        header.lists_fingerprint = os_lists_fingerprint;
+        bool written = ti_Write(&header, sizeof(CatalogHeader), 1, handle) == 1 &&
+                       cast(s24)ti_Write(os_programs, sizeof(OS_Program), cast(size_t)os_programs_count, handle) == os_programs_count &&
+                       cast(s24)ti_Write(os_lists, sizeof(OS_List), cast(size_t)os_lists_count, handle) == os_lists_count;
+        // NOTE: After running a program, load_catalog runs with the program already loaded again
+        if(written) {
+            archive_variable(handle);
+        }
+        ti_Close(handle);
+        if(!written) { ti_Delete(CATALOG_APPVAR_NAME); }
+    }
+    catalog_changed = false;
+}
+
+void load_catalog(void) {
+    os_programs_count = scan_vat(OS_TYPE_PRGM, null, sizeof(OS_Program), sizeof(os_programs->name), &os_programs_fingerprint);
+    os_lists_count = scan_vat(OS_TYPE_REAL_LIST, null, sizeof(OS_List), sizeof(os_lists->name), &os_lists_fingerprint);
+    os_programs = malloc(cast(size_t)max(1, os_programs_count) * sizeof(OS_Program));
+    os_lists = malloc(cast(size_t)max(1, os_lists_count) * sizeof(OS_List));
+    if(!os_programs || !os_lists) {
+        // NOTE: The heap has room for thousands of names, so this shouldn't happen. Show nothing rather than crash.
+        log("Not enough heap for %d programs and %d lists\n", os_programs_count, os_lists_count);
+        os_programs_count = 0;
+        os_lists_count = 0;
+    } else {
+        bool cached = false;
+        u8 handle = ti_Open(CATALOG_APPVAR_NAME, "r");
+        if(handle) {
+            CatalogHeader header;
+            cached = ti_Read(&header, sizeof(CatalogHeader), 1, handle) == 1 &&
+                     header.version == CATALOG_VERSION &&
+                     cast(s24)header.programs_count == os_programs_count && header.programs_fingerprint == os_programs_fingerprint &&
+                     cast(s24)header.lists_count == os_lists_count && header.lists_fingerprint == os_lists_fingerprint &&
+                     cast(s24)ti_Read(os_programs, sizeof(OS_Program), cast(size_t)os_programs_count, handle) == os_programs_count &&
+                     cast(s24)ti_Read(os_lists, sizeof(OS_List), cast(size_t)os_lists_count, handle) == os_lists_count;
+            ti_Close(handle);
+        }
+        if(cached) {
+            // NOTE: Editing, archiving or unarchiving a program in TI-OS leaves the names alone
+            if(load_program_info()) {
+                catalog_changed = true;
+            }
+        } else {
+            scan_vat(OS_TYPE_PRGM, cast(u8*)os_programs, sizeof(OS_Program), sizeof(os_programs->name), &os_programs_fingerprint);
+            scan_vat(OS_TYPE_REAL_LIST, cast(u8*)os_lists, sizeof(OS_List), sizeof(os_lists->name), &os_lists_fingerprint);
+            sort_catalog(cast(u8*)os_programs, sizeof(OS_Program), os_programs_count, compare_program_names);
+            sort_catalog(cast(u8*)os_lists, sizeof(OS_List), os_lists_count, compare_list_names);
+            load_program_info();
+            write_catalog();
+            // NOTE: Programs were added, removed or renamed, which is when journals go stale
+            drop_stale_undo_journals();
+        }
     }
+    // NOTE: Hard-coded functionality
+    directories[DIR_PRGM].lists[3].tokens_count = cast(s16)min(os_programs_count, 0x7FFF);
+    directories[DIR_LIST].lists[0].tokens_count = cast(s16)min(os_lists_count, 0x7FFF);
 }
 
+typedef struct RunPrgmCallbackReconstructProgram {
+    u8 program_name[9];
+    s24 cursor;
+    s24 view_top_line;
+} RunPrgmCallbackReconstructProgram;
+
+u8 key_down[8];
+u8 key_held[8];
+u8 key_up[8];
+u8 key_debounced[8];
+// NOTE: Keys repeat in real time, not in frames or input ticks, so holding one does the same
+// whatever the rates are. Arrows speed up the longer they're held, down to the fastest interval.
+#define KEY_REPEAT_DELAY_CLOCK_CYCLES cast(s24)((200*cast(u24)CLOCKS_PER_SEC)/1000)
+#define KEY_REPEAT_INTERVAL_CLOCK_CYCLES cast(s24)((66*cast(u24)CLOCKS_PER_SEC)/1000)
+#define ARROW_REPEAT_SPEEDUP_CLOCK_CYCLES cast(s24)((4*cast(u24)CLOCKS_PER_SEC)/1000)
+#define ARROW_REPEAT_FASTEST_CLOCK_CYCLES cast(s24)((16*cast(u24)CLOCKS_PER_SEC)/1000)
+u24 key_repeat_clock[8][8];
+u8 key_repeats[8][8];
+bool on_pressed;
+bool on_held;
+
+void gc_before() { gfx_End(); }
+void gc_after() {
+    gfx_Begin();
+#if SINGLE_BUFFERED
+    gfx_SetDrawScreen();
+#else
+    gfx_SetDrawBuffer();
+#endif
+    // NOTE: gfx_Begin resets the screen, so nothing we drew before is there anymore.
+    // With SINGLE_BUFFERED that goes for program.data too, see archive_variable.
+    program.redraw_all = true;
+}
 int main() {
     initialize_graphics();
     kb_DisableOnLatch();
     ti_SetGCBehavior(gc_before, gc_after);
     fontlib_SetFont(editor_font, 0);
+    build_glyph_atlas();
+    build_token_string_cache();
 
     {
         u8 editor_settings_handle = ti_Open(SETTINGS_DATA_APPVAR_NAME, "r");
@@ -708,120 +1363,26 @@ int main() {
     }
     update_editor_theme_based_on_settings();
 
-    {
-        // NOTE: Scan OS for programs
-        void *it = null;
-        while(true) {
-            char *name = ti_DetectVar(&it, null, OS_TYPE_PRGM);
-            if(!name) {
-                break;
-            } else {
-                bool name_valid = (name[0] != '!' && name[0] != '#');
-                if(name_valid) {
-                    os_programs_count += 1;
-                    char *dest = (char*)os_programs[os_programs_count - 1].name;
-                    log("Loading program %s\n", name);
-                    for(char *val = name; val <= name + 7; val += 1, dest += 1) {
-                        *dest = *val;
-                        if(*val == 0) {
-                            break;
-                        }
-                    }
-                    if(os_programs_count == ARRLEN(os_programs)) {
-                        break;
-                    }
-                }
-            }
-        }
-
-        // NOTE: Bubble sort (could switch to radix later maybe, if startup time is long)
-        for(int i = 0; i < os_programs_count - 1; ++i) {
-            bool early_out = true;
-            for(int j = 0; j < os_programs_count - (1+i); ++j) {
-                s24 a = j;
-                s24 b = j + 1;
-                u24 a_cost = alphabetical_sort_cost((char*)os_programs[a].name);
-                u24 b_cost = alphabetical_sort_cost((char*)os_programs[b].name);
-                if(a_cost > b_cost) {
-                    OS_Program a_temp = os_programs[a];
-                    os_programs[a] = os_programs[b];
-                    os_programs[b] = a_temp;
-                    early_out = false;
-                }
-            }
-            if(early_out) { break; }
-        }
-        // NOTE: Hard-coded functionality
-        directories[DIR_PRGM].lists[3].tokens_count = cast(s16)os_programs_count;
-    }
-
-    {
-        // NOTE: Scan OS for lists
-        void *it = null;
-        while(true) {
-            char *name = ti_DetectVar(&it, null, OS_TYPE_REAL_LIST);
-            if(!name) {
-                break;
-            } else {
-                // NOTE: Lists start with 0x5D no matter what, and we don't care.
-                name += 1;
-                bool name_valid = true;
-                for(u8 i = 0; i <= 5 - 1; ++i) {
-                    if(i == 1 && name[i] >= 0 && name[i] <= 5) { name_valid = false; break; }
-                }
-                if(name_valid) {
-                    os_lists_count += 1;
-                    char *dest = (char*)os_lists[os_lists_count - 1].name;
-                    log("Loading list %s\n", name);
-                    for(char *val = name; val <= name + 5; val += 1, dest += 1) {
-                        *dest = *val;
-                        if(*val == 0) {
-                            break;
-                        }
-                    }
-                    if(os_lists_count == ARRLEN(os_lists)) {
-                        break;
-                    }
-                }
-            }
-        }
-
-        // NOTE: Bubble sort (could switch to radix later maybe, if startup time is long)
-        for(int i = 0; i < os_lists_count - 1; ++i) {
-            bool early_out = true;
-            for(int j = 0; j < os_lists_count - (1+i); ++j) {
-                s24 a = j;
-                s24 b = j + 1;
-                u24 a_cost = alphabetical_sort_cost((char*)os_lists[a].name);
-                u24 b_cost = alphabetical_sort_cost((char*)os_lists[b].name);
-                if(a_cost > b_cost) {
-                    OS_List a_temp = os_lists[a];
-                    os_lists[a] = os_lists[b];
-                    os_lists[b] = a_temp;
-                    early_out = false;
-                }
-            }
-            if(early_out) { break; }
-        }
-        // NOTE: Hard-coded functionality
-        directories[DIR_LIST].lists[0].tokens_count = cast(s16)os_lists_count;
-    }
+    load_catalog();
     
     #define TARGET_FRAMERATE (15)
     #define TARGET_CLOCKS_PER_FRAME cast(s24)((cast(u24)CLOCKS_PER_SEC) / TARGET_FRAMERATE)
+    // NOTE: The keyboard is scanned and edits are applied at this rate, whatever the frame rate,
+    // so a keypress waits at most one input tick and never for a render. Several ticks may run between frames.
+    #define INPUT_RATE (100)
+    #define INPUT_CLOCKS_PER_TICK cast(s24)((cast(u24)CLOCKS_PER_SEC) / INPUT_RATE)
     
     s24 clock_counter = 0;
+    s24 input_clock_counter = 0;
     u24 previous_clock = cast(u24)clock();
-
-#if DEBUG
-    u24 last_frame = cast(u24)clock();
-#endif
+    u24 previous_input_clock = previous_clock;
 
     #define AUTOSAVE_INTERVAL_MILLISECONDS (10000)
     #define AUTOSAVE_INTERVAL_CLOCK_CYCLES ((AUTOSAVE_INTERVAL_MILLISECONDS*CLOCKS_PER_SEC)/1000)
     s24 clock_cycles_until_autosave = AUTOSAVE_INTERVAL_CLOCK_CYCLES;
 
     editor.running = true;
+    editor.render_requested = true;
     if(os_programs_count == 0) {
         exit_with_message("No TI-Basic programs found.");
     }
@@ -830,37 +1391,144 @@ int main() {
         s24 diff = cast(s24)(current_clock - previous_clock);
         previous_clock = current_clock;
         clock_counter -= diff;
+        input_clock_counter -= diff;
         if(program.program_loaded) {
             clock_cycles_until_autosave -= diff;
             if(clock_cycles_until_autosave <= 0) {
                 clock_cycles_until_autosave = AUTOSAVE_INTERVAL_CLOCK_CYCLES;
-                save_program(false);
+                // NOTE: The save is written in slices while we wait for frames, see below.
+                // If the frames left no time for it since the last autosave, it's finished now.
+                if(program.autosaving || program.save_needs_full_write) {
+                    save_program();
+                } else if(program.saved_generation != program.edit_generation) {
+                    program.autosaving = true;
+                }
+            }
+        }
+        if(input_clock_counter <= 0) {
+            // NOTE: Don't try to catch up on ticks an update or render took too long for
+            input_clock_counter = max(input_clock_counter + INPUT_CLOCKS_PER_TICK, 1);
+            u24 phase_clock = cast(u24)clock();
+            update_input();
+            phase_clock = end_profile_phase(ProfilePhase_Input, phase_clock);
+            // NOTE: When nothing is held there's nothing for update() to do,
+            // and nothing changed on screen because of input.
+            if(any_key_held()) {
+                update();
+                phase_clock = end_profile_phase(ProfilePhase_Update, phase_clock);
+                editor.render_requested = true;
+                // NOTE: The key went down some time since the previous scan,
+                // so this is the longest it can have taken to get into the program.
+                if(any_key_pressed()) {
+                    end_profile_phase(ProfilePhase_Latency, previous_input_clock);
+                }
             }
+            previous_input_clock = phase_clock;
         }
+        // NOTE: The time left before whichever comes first, the next frame or the next input tick
+        s24 clock_cycles_until_tick = min(clock_counter, input_clock_counter);
         if(clock_counter <= 0) {
             clock_counter = TARGET_CLOCKS_PER_FRAME;
+            profiler.ran_this_frame = 0;
+            u24 frame_started_clock = cast(u24)clock();
+            u24 phase_clock = frame_started_clock;
+
+            // NOTE: Idle frames leave all of their time to the indexing, saving and sleeping below.
+            // Nothing was drawn, so present_frame has nothing to copy.
+            if(program.redraw_all || editor.render_requested) {
+                editor.render_requested = false;
+                render();
+                phase_clock = end_profile_phase(ProfilePhase_Render, phase_clock);
+            }
+            // NOTE: Not part of any phase, so showing the numbers doesn't change the render numbers
+            if(profiler.visible) {
+                draw_profiler();
+                phase_clock = cast(u24)clock();
+            }
+            present_frame();
+            phase_clock = end_profile_phase(ProfilePhase_Present, phase_clock);
+            if(program.program_loaded && !program.fully_indexed) {
+                index_program(PROGRAM_INDEX_SLICE_BYTES);
+                end_profile_phase(ProfilePhase_Index, phase_clock);
+                editor.render_requested = true;
+            }
+            end_profile_phase(ProfilePhase_Frame, frame_started_clock);
+            profiler.frames += 1;
 #if DEBUG
-            u24 frame_time_ms = ((current_clock - last_frame) * 1000) / cast(u24)CLOCKS_PER_SEC;
-            last_frame = current_clock;
-            I_KNOW_ITS_UNUSED(frame_time_ms);
-            // log("%dms (target %dms)\n",frame_time_ms, (TARGET_CLOCKS_PER_FRAME*1000)/cast(u24)CLOCKS_PER_SEC);
+            if(profiler.visible) {
+                log_profile_frame();
+            }
 #endif
-
-            update_input();
-            update();
-            render();
-            gfx_SwapDraw();
+        } else if(program.autosaving) {
+            // NOTE: Slices are small, so stop when there's less than one slice's worth of time before the tick
+            #define AUTOSAVE_SLICE_BYTES 1024
+            #define AUTOSAVE_SLICE_CLOCK_CYCLES (CLOCKS_PER_SEC / 200)
+            bool finished = false;
+            bool saved_slice = false;
+            u24 slices_started_clock = cast(u24)clock();
+            while(!finished && cast(s24)(cast(u24)clock() - current_clock) < clock_cycles_until_tick - AUTOSAVE_SLICE_CLOCK_CYCLES) {
+                finished = save_program_slice(AUTOSAVE_SLICE_BYTES);
+                saved_slice = true;
+            }
+            if(saved_slice) {
+                end_profile_phase(ProfilePhase_Autosave, slices_started_clock);
+            }
+            if(finished) {
+                program.autosaving = false;
+            }
+        } else if(program.program_loaded && !program.fully_indexed) {
+            // NOTE: Same as the autosave slices above, with the time idle frames leave over.
+            // These are smaller than the slice every frame gets, so they fit between input ticks.
+            bool indexed_slice = false;
+            u24 slices_started_clock = cast(u24)clock();
+            while(!program.fully_indexed && cast(s24)(cast(u24)clock() - current_clock) < clock_cycles_until_tick - PROGRAM_IDLE_INDEX_SLICE_CLOCK_CYCLES) {
+                index_program(PROGRAM_IDLE_INDEX_SLICE_BYTES);
+                indexed_slice = true;
+            }
+            if(indexed_slice) {
+                end_profile_phase(ProfilePhase_Index, slices_started_clock);
+                editor.render_requested = true;
+            }
+        } else if(!editor.render_requested && !program.redraw_all && !profiler.visible && !any_key_held()) {
+            // NOTE: Nothing to draw, save or index and no key held, so nothing happens until a key goes down.
+            // Instead of waking for every input tick and frame, only scan the keyboard every IDLE_SCAN_MS.
+            // A second at most, so the autosave timer still runs and clock() differences stay in range.
+            #define IDLE_SCAN_MS (30)
+            #define IDLE_MAX_CLOCK_CYCLES cast(s24)(CLOCKS_PER_SEC)
+            bool key_down_while_idle = false;
+            while(!key_down_while_idle && cast(s24)(cast(u24)clock() - current_clock) < IDLE_MAX_CLOCK_CYCLES) {
+                msleep(IDLE_SCAN_MS);
+                kb_Scan();
+                key_down_while_idle = kb_On;
+                for(u8 i = 1; i < 8; i++) {
+                    if(kb_Data[i] != 0) { key_down_while_idle = true; }
+                }
+                // NOTE: A key that goes down later went down after this scan, for the latency row
+                if(!key_down_while_idle) { previous_input_clock = cast(u24)clock(); }
+            }
+            // NOTE: Straight into an input tick, so the key isn't kept waiting any longer
+            input_clock_counter = 0;
         } else {
-            // NOTE: If we're within 50 milliseconds of a frame, don't use sleep as the thread may not wake in time?
-            // TODO: (but I don't know how inaccurate the timer is, and how close we can cut it)
-            u16 ms_until_frame = cast(u16)((cast(u24)clock_counter * 1000) / cast(u24)CLOCKS_PER_SEC);
-            if(ms_until_frame >= 50) msleep(ms_until_frame - 50);
+            // NOTE: Input ticks are only a few milliseconds apart, so sleep until just before the next one.
+            // Waking late only delays that scan by as much, which shows up in the profiler's latency row.
+            u16 ms_until_tick = cast(u16)((cast(u24)clock_cycles_until_tick * 1000) / cast(u24)CLOCKS_PER_SEC);
+            if(ms_until_tick >= 4) msleep(ms_until_tick - 2);
         }
         
     }
 
     if(program.program_loaded) {
-        save_program(true);
+        save_program();
+        close_undo_journal();
+        close_program_window();
+        program.data_released = true;
+        archive_undo_journal();
+        archive_program_if_it_was();
+    }
+    if(catalog_changed) {
+        // NOTE: The program list may be sorted by size
+        sort_catalog(cast(u8*)os_programs, sizeof(OS_Program), os_programs_count, compare_program_names);
+        write_catalog();
     }
 
     if(editor.exit_message_at_end != null) {
@@ -876,7 +1544,9 @@ int main() {
         fontlib_SetTransparency(true);
         draw_string("Aether exited with message", 320/2 - (FONT_WIDTH*26)/2, 240/2 - FONT_HEIGHT - FONT_HEIGHT - 2);
         draw_string(editor.exit_message_at_end, 320/2 - (FONT_WIDTH*message_length)/2, 240/2 - FONT_HEIGHT);
+#if !SINGLE_BUFFERED
         gfx_SwapDraw();
+#endif
         while(clock() - start <= DISPLAY_EXIT_MESSAGE_FOR_CLOCK_CYCLES) {
             msleep(10);
         }
@@ -895,9 +1565,7 @@ int main() {
                 editor.settings.last_cursor_y = cast(u16)calculate_cursor_y();
             }
             ti_Write(&editor.settings, sizeof(EditorSettings), 1, editor_settings_handle);
-            if(ti_ArchiveHasRoomVar(editor_settings_handle)) {
-                ti_SetArchiveStatus(true, editor_settings_handle);
-            }
+            archive_variable(editor_settings_handle);
             ti_Close(editor_settings_handle);
         }
     }
@@ -937,48 +1605,632 @@ int run_prgm_callback(void *data_, int retval) {
     return result;
 }
 
-// Takes a linebreak Y, returns offset into program.data
+// Takes a linebreak Y, returns offset into the program
+s24 find_line_block(s24 line) {
+    s24 result = program.line_block_cache;
+    if(result > program.line_blocks_count - 1 || line < program.line_blocks[result].first_line ||
+       line >= program.line_blocks[result].first_line + program.line_blocks[result].count) {
+        s24 low = 0;
+        s24 high = program.line_blocks_count - 1;
+        while(low < high) {
+            s24 middle = low + (high - low + 1) / 2;
+            if(program.line_blocks[middle].first_line <= line) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        result = low;
+        program.line_block_cache = result;
+    }
+    return result;
+}
+
+Linebreak *get_linebreak(s24 line) {
+    LineBlock *block = &program.line_blocks[find_line_block(line)];
+    return &block->lines[line - block->first_line];
+}
+
 s24 get_linebreak_location(int i) {
     if(i == 0) {
         return -1;
     }
-    return cast(s24)program.linebreaks[i].location_;
+    LineBlock *block = &program.line_blocks[find_line_block(i)];
+    return block->base + cast(s24)block->lines[i - block->first_line].location_;
 }
 
-void draw_string(char* str, u24 x, u8 y) {
-    fontlib_SetCursorPosition(x, y);
-    fontlib_DrawString(str);
+// NOTE: Only for linebreaks that were just added, in order. The first one in a block sets the block's base.
+void set_linebreak_location(s24 line, s24 location) {
+    LineBlock *block = &program.line_blocks[find_line_block(line)];
+    s24 index = line - block->first_line;
+    if(index == 0) {
+        block->base = location;
+    }
+    block->lines[index].location_ = cast(u16)(location - block->base);
 }
-void draw_string_max_chars(char* str, u24 max, u24 x, u8 y) {
-    fontlib_SetCursorPosition(x, y);
-    fontlib_DrawStringL(str, max);
+
+u8 get_cold_program_byte(s24 pos);
+
+// Takes an offset into the program, returns the byte there
+static inline u8 get_program_byte(s24 pos) {
+    s24 physical = pos - program.window_start;
+    if(physical >= program.gap_start) {
+        physical += program.gap_end - program.gap_start;
+    }
+    if(cast(u24)physical >= PROGRAM_DATA_SIZE) {
+        return get_cold_program_byte(pos);
+    }
+    return program.data[physical];
 }
 
-void update_input(void) {
-    kb_Scan();
-    static uint8_t last_pressed[8];
-    static uint8_t pressed_or_released[8];
-    for(u8 i = 1; i < 8; i++) {
-        pressed_or_released[i] = last_pressed[i] ^ kb_Data[i];
-        key_up[i]   = ( last_pressed[i]) & pressed_or_released[i];
-        key_down[i] = (~last_pressed[i]) & pressed_or_released[i];
-        key_held[i] = kb_Data[i];
-        last_pressed[i] = kb_Data[i];
-        
-        for(u8 bit_index = 0; bit_index < 8; ++bit_index) {
-            u8 mask = (u8)((u8)1 << bit_index);
-            
-            if(key_held[i] & mask) {
-                if(key_timers[i][bit_index] < 255) {
-                    key_timers[i][bit_index] += 1;
-                }
-            } else {
-                key_timers[i][bit_index] = 0;
-            }
-            
-            if(key_timers[i][bit_index] == 1 ||
-               key_timers[i][bit_index] >= 4) {
-                key_debounced[i] |= mask;
+s24 get_program_window_size(void) {
+    return program.size - program.window_start - program.cold_after;
+}
+
+// NOTE: Moves the gap so it starts at program position `pos`, which must be in the window. Costs the distance moved,
+// so edits next to the last edit are cheap no matter how big the program is.
+void move_program_gap(s24 pos) {
+    pos -= program.window_start;
+    assert(pos >= 0 && pos <= get_program_window_size(), "Gap out of range");
+    if(pos < program.gap_start) {
+        s24 count = program.gap_start - pos;
+        copy_overlapping(program.data + pos, program.data + program.gap_end - count, count);
+        program.gap_start -= count;
+        program.gap_end -= count;
+    } else if(pos > program.gap_start) {
+        s24 count = pos - program.gap_start;
+        copy_overlapping(program.data + program.gap_end, program.data + program.gap_start, count);
+        program.gap_start += count;
+        program.gap_end += count;
+    }
+}
+
+// NOTE: ti_GetTokenString wants the token's bytes next to each other,
+// so if a token straddles the gap, this returns a copy of it instead.
+// Tokens that aren't in the window, or straddle its end, get copied too.
+u8 *get_program_token_pointer(s24 pos) {
+    static u8 straddling_token[2];
+    u8 *result;
+    s24 in_window = pos - program.window_start;
+    if(in_window + 1 == program.gap_start || in_window < 0 || in_window + 1 >= get_program_window_size()) {
+        straddling_token[0] = get_program_byte(pos);
+        straddling_token[1] = (pos + 1 <= program.size - 1) ? get_program_byte(pos + 1) : 0;
+        result = straddling_token;
+    } else if(in_window >= program.gap_start) {
+        result = program.data + in_window + (program.gap_end - program.gap_start);
+    } else {
+        result = program.data + in_window;
+    }
+    return result;
+}
+
+// NOTE: Windowed programs.
+// The appvar holds the window_start bytes before the window, then the cold_after bytes after it,
+// so the window sits between them like the gap does in data. Sliding the window swaps bytes
+// across that boundary without changing the appvar's size. Making room in data grows it,
+// and taking the bytes back once there's room again shrinks it.
+// Edits and the cursor keep the window around them, so cold bytes are only read by passes over the
+// whole program (saving, indentation) and those go a page at a time.
+// With SINGLE_BUFFERED every program fits in data, so none of this ever runs.
+#define PROGRAM_WINDOW_APPVAR_NAME "AETHRWIN"
+// NOTE: When the window has to make room, it makes this much extra so the next edits don't have to
+#define PROGRAM_WINDOW_MIN_GAP 4096
+// NOTE: The most bytes inserted or removed at once. Bigger removals are split up.
+// Leaves enough in the window after making room that whatever's being edited always fits in it.
+#define PROGRAM_MAX_EDIT_SIZE (PROGRAM_DATA_SIZE / 3)
+// NOTE: How close to the edge of the window the cursor gets before the window moves
+#define PROGRAM_WINDOW_MARGIN 2048
+
+u8 get_cold_program_byte(s24 pos) {
+    u8 result = 0;
+    if(pos >= 0 && pos <= program.size - 1 && program.windowed) {
+        s24 file_pos = pos;
+        if(pos >= program.window_start) {
+            file_pos = pos - (program.size - program.cold_after) + program.window_start;
+        }
+        if(program.cold_page_start < 0 || file_pos < program.cold_page_start || file_pos >= program.cold_page_start + COLD_PAGE_SIZE) {
+            program.cold_page_start = file_pos - (file_pos % COLD_PAGE_SIZE);
+            u8 handle = ti_Open(PROGRAM_WINDOW_APPVAR_NAME, "r");
+            assert(handle != 0, "Window appvar is gone");
+            if(handle) {
+                ti_Seek(cast(int)program.cold_page_start, SEEK_SET, handle);
+                ti_Read(program.cold_page, 1, COLD_PAGE_SIZE, handle);
+                ti_Close(handle);
+            }
+        }
+        result = program.cold_page[file_pos - program.cold_page_start];
+    }
+    return result;
+}
+
+// NOTE: Moves count bytes from the start (from_start) or end of the window into the appvar
+bool move_out_of_program_window(s24 count, bool from_start) {
+    bool result = false;
+    u8 handle = ti_Open(PROGRAM_WINDOW_APPVAR_NAME, "r+");
+    if(handle) {
+        s24 cold_size = program.window_start + program.cold_after;
+        if(ti_Resize(cast(size_t)(cold_size + count), handle) == cold_size + count) {
+            u8 *source;
+            if(from_start) {
+                move_program_gap(program.window_start);
+                source = program.data + program.gap_end;
+            } else {
+                move_program_gap(program.window_start + get_program_window_size());
+                source = program.data + program.gap_start - count;
+            }
+            // NOTE: The data pointer is good until the next time an appvar or program changes size
+            ti_Seek(0, SEEK_SET, handle);
+            u8 *cold = cast(u8*)ti_GetDataPtr(handle);
+            copy_overlapping(cold + program.window_start, cold + program.window_start + count, program.cold_after);
+            copy(source, cold + program.window_start, count);
+            if(from_start) {
+                program.gap_end += count;
+                program.window_start += count;
+            } else {
+                program.gap_start -= count;
+                program.cold_after += count;
+            }
+            program.cold_page_start = -1;
+            result = true;
+        }
+        ti_Close(handle);
+    }
+    return result;
+}
+
+// NOTE: Moves count bytes from the appvar into the start (to_start) or end of the window.
+// The gap has to have room for them.
+void move_into_program_window(s24 count, bool to_start) {
+    assert(count <= PROGRAM_DATA_SIZE - get_program_window_size(), "No room in the gap");
+    u8 handle = ti_Open(PROGRAM_WINDOW_APPVAR_NAME, "r+");
+    if(handle) {
+        s24 cold_size = program.window_start + program.cold_after;
+        s24 removing_at;
+        ti_Seek(0, SEEK_SET, handle);
+        u8 *cold = cast(u8*)ti_GetDataPtr(handle);
+        if(to_start) {
+            removing_at = program.window_start - count;
+            move_program_gap(program.window_start);
+            copy(cold + removing_at, program.data, count);
+            program.gap_start += count;
+            program.window_start -= count;
+        } else {
+            removing_at = program.window_start;
+            move_program_gap(program.window_start + get_program_window_size());
+            copy(cold + removing_at, program.data + program.gap_end - count, count);
+            program.gap_end -= count;
+            program.cold_after -= count;
+        }
+        copy_overlapping(cold + removing_at + count, cold + removing_at, cold_size - removing_at - count);
+        ti_Resize(cast(size_t)(cold_size - count), handle);
+        program.cold_page_start = -1;
+        ti_Close(handle);
+    }
+}
+
+// NOTE: Slides the window by `by` bytes. The bytes coming in are read into the gap first,
+// so `by` can't be more than the gap or the window.
+void slide_program_window(s24 by) {
+    s24 window_size = get_program_window_size();
+    assert(by != 0 && (by < 0 ? -by : by) <= min(PROGRAM_DATA_SIZE - window_size, window_size), "Slid too far");
+    assert(by < 0 ? -by <= program.window_start : by <= program.cold_after, "Slid out of the program");
+    u8 handle = ti_Open(PROGRAM_WINDOW_APPVAR_NAME, "r+");
+    if(handle) {
+        move_program_gap(program.window_start + window_size);
+        u8 *coming_in = program.data + window_size;
+        if(by > 0) {
+            // NOTE: The start of what's after the window comes in at the end,
+            // and the start of the window goes where it was
+            ti_Seek(cast(int)program.window_start, SEEK_SET, handle);
+            ti_Read(coming_in, 1, cast(size_t)by, handle);
+            ti_Seek(cast(int)program.window_start, SEEK_SET, handle);
+            ti_Write(program.data, 1, cast(size_t)by, handle);
+            copy_overlapping(program.data + by, program.data, window_size);
+            program.window_start += by;
+            program.cold_after -= by;
+        } else {
+            // NOTE: The end of what's before the window comes in at the start,
+            // and the end of the window goes where it was
+            s24 count = -by;
+            ti_Seek(cast(int)(program.window_start - count), SEEK_SET, handle);
+            ti_Read(coming_in, 1, cast(size_t)count, handle);
+            ti_Seek(cast(int)(program.window_start - count), SEEK_SET, handle);
+            ti_Write(program.data + window_size - count, 1, cast(size_t)count, handle);
+            copy_overlapping(program.data, program.data + count, window_size - count);
+            copy(coming_in, program.data, count);
+            program.window_start -= count;
+            program.cold_after += count;
+        }
+        program.cold_page_start = -1;
+        ti_Close(handle);
+    }
+}
+
+// NOTE: Makes sure program positions [first, end) are in the window and there's room to insert `room` bytes,
+// moving the window and the bytes in it to and from the appvar as needed. Programs that fit in data don't
+// have an appvar until they stop fitting. Returns false if it can't be done.
+bool fit_program_window(s24 first, s24 end, s24 room) {
+    s24 window_size = get_program_window_size();
+    bool covered = first >= program.window_start && end <= program.window_start + window_size;
+    // NOTE: Sliding the window goes through the gap, so it needs some room too
+    bool has_room = PROGRAM_DATA_SIZE - window_size >= (covered ? room : max(room, PROGRAM_WINDOW_MIN_GAP));
+    if(has_room && covered) {
+        return true;
+    }
+    if(room > PROGRAM_MAX_EDIT_SIZE || end - first > PROGRAM_MAX_EDIT_SIZE) {
+        return false;
+    }
+    if(!program.windowed) {
+        u8 handle = ti_Open(PROGRAM_WINDOW_APPVAR_NAME, "w");
+        if(handle == 0) {
+            return false;
+        }
+        ti_Close(handle);
+        program.windowed = true;
+        program.cold_page_start = -1;
+    }
+
+    if(!has_room) {
+        // NOTE: Moves out what's furthest from [first, end), the end of the window first
+        s24 window_end = program.window_start + window_size;
+        s24 spare_at_start = max(0, min(first, window_end) - program.window_start);
+        s24 spare_at_end = max(0, window_end - max(end, program.window_start));
+        s24 moving = room + PROGRAM_WINDOW_MIN_GAP - (PROGRAM_DATA_SIZE - window_size);
+        assert(moving > 0, "Should be making room");
+        moving = min(moving, spare_at_start + spare_at_end);
+        s24 from_end = min(moving, spare_at_end);
+        if(from_end > 0 && !move_out_of_program_window(from_end, false)) {
+            return false;
+        }
+        if(moving - from_end > 0 && !move_out_of_program_window(moving - from_end, true)) {
+            return false;
+        }
+        window_size = get_program_window_size();
+        if(PROGRAM_DATA_SIZE - window_size < room) {
+            return false;
+        }
+    }
+
+    // NOTE: Center [first, end) in the window
+    if(first < program.window_start || end > program.window_start + window_size) {
+        s24 target = first - (window_size - (end - first)) / 2;
+        target = max(0, min(target, program.size - window_size));
+        while(program.window_start != target) {
+            s24 step = min(PROGRAM_DATA_SIZE - window_size, window_size);
+            if(target > program.window_start) {
+                slide_program_window(min(target - program.window_start, step));
+            } else {
+                slide_program_window(-min(program.window_start - target, step));
+            }
+        }
+    }
+    return first >= program.window_start && end <= program.window_start + window_size;
+}
+
+void close_program_window(void) {
+    if(program.windowed) {
+        ti_Delete(PROGRAM_WINDOW_APPVAR_NAME);
+        program.windowed = false;
+    }
+}
+
+// NOTE: Called every update. Also takes back what making room moved out once there's room for it again,
+// and goes back to not being windowed if everything fits.
+void keep_program_window_around_cursor(void) {
+    if(program.windowed) {
+        s24 first = max(0, program.cursor - PROGRAM_WINDOW_MARGIN);
+        s24 end = min(program.size, program.cursor + PROGRAM_WINDOW_MARGIN);
+        bool fitted = fit_program_window(first, end, 0);
+        I_KNOW_ITS_UNUSED(fitted);
+
+        s24 spare = PROGRAM_DATA_SIZE - get_program_window_size() - PROGRAM_WINDOW_MIN_GAP;
+        if(spare >= PROGRAM_WINDOW_MIN_GAP) {
+            s24 to_end = min(spare, program.cold_after);
+            if(to_end > 0) {
+                move_into_program_window(to_end, false);
+            }
+            s24 to_start = min(spare - to_end, program.window_start);
+            if(to_start > 0) {
+                move_into_program_window(to_start, true);
+            }
+        }
+        if(program.window_start == 0 && program.cold_after == 0) {
+            close_program_window();
+        }
+    }
+}
+
+// NOTE: Display strings of tokens, so drawing and measuring don't ask the OS every frame.
+// ti_GetTokenString copies into a scratch buffer on every call, so the strings are copied into
+// token_string_pool as a length byte followed by the characters (not null terminated).
+// token_string_offsets has an entry for every one byte token, then one for every two byte token
+// in token_string_ranges, holding where its string is in the pool.
+// token_string_first_range finds a token's range from its first byte, without going through all of them.
+// Anything else (invalid tokens, tokens from newer OSes, a full pool) asks the OS like before.
+typedef struct TokenStringRange {
+    u8 prefix;
+    u8 first;
+    u8 last;
+    u16 first_entry;
+} TokenStringRange;
+TokenStringRange token_string_ranges[] = {
+    { 0x5C, 0x00, 0x09, 0 }, // Matrices
+    { 0x5D, 0x00, 0x05, 0 }, // Lists
+    { 0x5E, 0x10, 0x2B, 0 }, // Functions and parametrics
+    { 0x5E, 0x40, 0x45, 0 }, // Polars
+    { 0x5E, 0x80, 0x82, 0 }, // Sequences
+    { 0x60, 0x00, 0x09, 0 }, // Pics
+    { 0x61, 0x00, 0x09, 0 }, // GDBs
+    { 0x62, 0x01, 0x3F, 0 }, // Stat vars
+    { 0x63, 0x00, 0x3F, 0 }, // Window and finance vars
+    { 0x7E, 0x00, 0x13, 0 }, // Graph format
+    { 0xAA, 0x00, 0x09, 0 }, // Strings
+    { 0xBB, 0x00, 0xF5, 0 },
+    { 0xEF, 0x00, 0xA7, 0 },
+};
+#define TOKEN_STRING_ENTRIES (256 + 10 + 6 + 28 + 6 + 3 + 10 + 10 + 63 + 64 + 20 + 10 + 246 + 168)
+#define TOKEN_STRING_NOT_CACHED 0xFFFF
+#define TOKEN_STRING_POOL_SIZE 6144
+u16 token_string_offsets[TOKEN_STRING_ENTRIES];
+u8 token_string_pool[TOKEN_STRING_POOL_SIZE];
+// NOTE: For every first byte, 1 + the index of the first range with it as the prefix, or 0 if it's a one byte token.
+// Ranges with the same prefix are next to each other in token_string_ranges.
+u8 token_string_first_range[256];
+
+// NOTE: Returns the entry for the token at `token`, or TOKEN_STRING_ENTRIES if it has none.
+u24 get_token_string_entry(u8 *token) {
+    u24 result = token[0];
+    u8 first_range = token_string_first_range[token[0]];
+    if(first_range != 0) {
+        result = TOKEN_STRING_ENTRIES;
+        for(u8 i = cast(u8)(first_range - 1); i < ARRLEN(token_string_ranges) && token_string_ranges[i].prefix == token[0]; ++i) {
+            TokenStringRange *range = token_string_ranges + i;
+            if(token[1] >= range->first && token[1] <= range->last) {
+                result = range->first_entry + cast(u24)(token[1] - range->first);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+// NOTE: Copies the string of one token into the pool. Returns whether it had room.
+bool cache_token_string(u8 *token, u24 entry, u24 *pool_used) {
+    bool two_byte = (entry >= 256);
+    u8 *ptr = token;
+    u8 token_length = 0;
+    u24 str_length = 0;
+    char *str = ti_GetTokenString(cast(void**)&ptr, &token_length, &str_length);
+    // NOTE: Prefix bytes the table doesn't know about read as two bytes here, and invalid tokens can have huge lengths.
+    // Leave those to the OS.
+    bool valid = (token_length == (two_byte ? 2 : 1)) && str_length > 0 && str_length < 40;
+    bool fits = (*pool_used + 1 + str_length <= TOKEN_STRING_POOL_SIZE);
+    if(valid && fits) {
+        token_string_offsets[entry] = cast(u16)*pool_used;
+        token_string_pool[*pool_used] = cast(u8)str_length;
+        copy(str, token_string_pool + *pool_used + 1, cast(s24)str_length);
+        *pool_used += 1 + str_length;
+    }
+    return fits || !valid;
+}
+
+void build_token_string_cache(void) {
+    u24 entry = 256;
+    for(u8 i = 0; i < ARRLEN(token_string_ranges); ++i) {
+        token_string_ranges[i].first_entry = cast(u16)entry;
+        entry += cast(u24)(token_string_ranges[i].last - token_string_ranges[i].first) + 1;
+        if(token_string_first_range[token_string_ranges[i].prefix] == 0) {
+            token_string_first_range[token_string_ranges[i].prefix] = cast(u8)(i + 1);
+        }
+    }
+    assert(entry == TOKEN_STRING_ENTRIES, "TOKEN_STRING_ENTRIES doesn't match token_string_ranges");
+    for(entry = 0; entry < TOKEN_STRING_ENTRIES; ++entry) {
+        token_string_offsets[entry] = TOKEN_STRING_NOT_CACHED;
+    }
+
+    u24 pool_used = 0;
+    bool room_left = true;
+    for(u24 byte = 0; byte <= 255 && room_left; ++byte) {
+        u8 token[2] = { cast(u8)byte, 0 };
+        // NOTE: Skips the prefixes of two byte tokens
+        if(get_token_string_entry(token) == byte) {
+            room_left = cache_token_string(token, byte, &pool_used);
+        }
+    }
+
+    for(u8 i = 0; i < ARRLEN(token_string_ranges) && room_left; ++i) {
+        TokenStringRange *range = token_string_ranges + i;
+        entry = range->first_entry;
+        for(u24 byte = range->first; byte <= range->last && room_left; ++byte, ++entry) {
+            u8 token[2] = { range->prefix, cast(u8)byte };
+            room_left = cache_token_string(token, entry, &pool_used);
+        }
+    }
+    log("Token string cache uses %d of %d bytes\n", pool_used, TOKEN_STRING_POOL_SIZE);
+}
+
+// NOTE: Same as ti_GetTokenString, except the string isn't null terminated.
+// Only use the first *str_length characters.
+char *get_token_string(u8 *token, u24 *str_length) {
+    char *result;
+    u24 entry = get_token_string_entry(token);
+    u16 offset = TOKEN_STRING_NOT_CACHED;
+    if(entry < TOKEN_STRING_ENTRIES) { offset = token_string_offsets[entry]; }
+    if(offset != TOKEN_STRING_NOT_CACHED) {
+        *str_length = token_string_pool[offset];
+        result = cast(char*)(token_string_pool + offset + 1);
+    } else {
+        void *ptr = token;
+        result = ti_GetTokenString(&ptr, null, str_length);
+    }
+    return result;
+}
+
+// NOTE: Copies count bytes of the window appvar starting at cold_at to a file, a page at a time
+bool write_cold_program_range(u8 handle, s24 cold_at, s24 count) {
+    bool success = false;
+    u8 cold = ti_Open(PROGRAM_WINDOW_APPVAR_NAME, "r");
+    if(cold) {
+        success = true;
+        program.cold_page_start = -1;
+        while(success && count > 0) {
+            s24 page = min(count, COLD_PAGE_SIZE);
+            ti_Seek(cast(int)cold_at, SEEK_SET, cold);
+            success = ti_Read(program.cold_page, 1, cast(size_t)page, cold) == cast(size_t)page &&
+                      ti_Write(program.cold_page, 1, cast(size_t)page, handle) == cast(size_t)page;
+            cold_at += page;
+            count -= page;
+        }
+        ti_Close(cold);
+    }
+    return success;
+}
+
+// NOTE: Writes program bytes [at, at + count) to a file.
+// The gap may split them, so it's up to two writes, plus what's before and after the window
+// if the program is windowed. Returns whether it all got written.
+bool write_program_range(u8 handle, s24 at, s24 count) {
+    bool success = true;
+    if(count > 0 && at < program.window_start) {
+        s24 before_window = min(count, program.window_start - at);
+        success = success && write_cold_program_range(handle, at, before_window);
+        at += before_window;
+        count -= before_window;
+    }
+    s24 window_end = program.size - program.cold_after;
+    s24 in_window = at - program.window_start;
+    if(count > 0 && in_window < program.gap_start) {
+        s24 before_gap = min(count, program.gap_start - in_window);
+        u24 written = ti_Write(program.data + in_window, 1, cast(u24)before_gap, handle);
+        success = success && (cast(s24)written == before_gap);
+        at += before_gap;
+        in_window += before_gap;
+        count -= before_gap;
+    }
+    if(count > 0 && at < window_end) {
+        s24 after_gap = min(count, window_end - at);
+        s24 physical = in_window + (program.gap_end - program.gap_start);
+        u24 written = ti_Write(program.data + physical, 1, cast(u24)after_gap, handle);
+        success = success && (cast(s24)written == after_gap);
+        at += after_gap;
+        count -= after_gap;
+    }
+    if(count > 0) {
+        success = success && write_cold_program_range(handle, program.window_start + (at - window_end), count);
+    }
+    return success;
+}
+
+void draw_string(char* str, u24 x, u8 y) {
+    fontlib_SetCursorPosition(x, y);
+    fontlib_DrawString(str);
+}
+void draw_string_max_chars(char* str, u24 max, u24 x, u8 y) {
+    fontlib_SetCursorPosition(x, y);
+    fontlib_DrawStringL(str, max);
+}
+
+// NOTE: The editor font is monospaced, so the editor view skips fontlib and copies glyphs
+// into the draw buffer itself. Each glyph is 1 bit per pixel, FONT_HEIGHT rows of FONT_WIDTH bits,
+// leftmost pixel in the top bit. It's built by drawing every glyph with fontlib once and reading it back,
+// so it always looks the same as the fontlib text in the rest of the program.
+static u8 glyph_atlas[256][FONT_HEIGHT];
+
+typedef enum GlyphColors {
+    GlyphColors_Normal,   // foreground on background
+    GlyphColors_Selected, // foreground on highlight
+    GlyphColors_Inverted, // background on foreground
+    GlyphColors_Count,
+} GlyphColors;
+// NOTE: The 4 pixels each nibble of an atlas row turns into, for every GlyphColors
+static u8 glyph_nibble_pixels[GlyphColors_Count][16][4];
+
+// NOTE: Draws in the back buffer so nothing shows on screen. When SINGLE_BUFFERED, that's the row staging lines,
+// which render() doesn't need between frames and which come before PROGRAM_STORE, so a loaded program is safe.
+void build_glyph_atlas(void) {
+    u8 draw_was = gfx_GetDraw();
+    gfx_SetDrawBuffer();
+    fontlib_SetForegroundColor(1);
+    fontlib_SetBackgroundColor(0);
+    fontlib_SetTransparency(false);
+    fontlib_SetFirstPrintableCodePoint(0);
+    for(u24 glyph = 0; glyph <= 255; ++glyph) {
+        fontlib_SetCursorPosition(0, 0);
+        fontlib_DrawGlyph(cast(u8)glyph);
+        for(u8 y = 0; y < FONT_HEIGHT; ++y) {
+            u8 bits = 0;
+            for(u8 x = 0; x < FONT_WIDTH; ++x) {
+                if(gfx_vbuffer[y][x] != 0) { bits |= cast(u8)(0x80 >> x); }
+            }
+            glyph_atlas[glyph][y] = bits;
+        }
+    }
+    gfx_SetDraw(draw_was);
+}
+
+void update_glyph_colors(void) {
+    u8 foregrounds[GlyphColors_Count] = { editor.foreground_color, editor.foreground_color, editor.background_color };
+    u8 backgrounds[GlyphColors_Count] = { editor.background_color, editor.highlight_color, editor.foreground_color };
+    for(u8 colors = 0; colors < GlyphColors_Count; ++colors) {
+        for(u8 nibble = 0; nibble < 16; ++nibble) {
+            for(u8 i = 0; i < 4; ++i) {
+                bool on = (nibble & (0x8 >> i)) != 0;
+                glyph_nibble_pixels[colors][nibble][i] = on ? foregrounds[colors] : backgrounds[colors];
+            }
+        }
+    }
+}
+
+// NOTE: Like draw_string_max_chars, but always opaque and it doesn't clip.
+// The caller makes sure the whole string fits on screen. Written out for FONT_WIDTH 7.
+void draw_glyphs(char *str, u24 max, u24 x, u8 y, GlyphColors colors) {
+    u8 (*pixels)[4] = glyph_nibble_pixels[colors];
+    u8 *top_left = &gfx_vbuffer[y][x];
+    for(u24 i = 0; i < max && str[i] != 0; ++i) {
+        u8 *glyph = glyph_atlas[cast(u8)str[i]];
+        u8 *dest = top_left;
+        for(u8 row = 0; row < FONT_HEIGHT; ++row) {
+            u8 *left = pixels[glyph[row] >> 4];
+            u8 *right = pixels[glyph[row] & 0x0F];
+            dest[0] = left[0]; dest[1] = left[1]; dest[2] = left[2]; dest[3] = left[3];
+            dest[4] = right[0]; dest[5] = right[1]; dest[6] = right[2];
+            dest += GFX_LCD_WIDTH;
+        }
+        top_left += FONT_WIDTH;
+    }
+}
+
+void update_input(void) {
+    kb_Scan();
+    u24 now = cast(u24)clock();
+    static uint8_t last_pressed[8];
+    static uint8_t pressed_or_released[8];
+    for(u8 i = 1; i < 8; i++) {
+        pressed_or_released[i] = last_pressed[i] ^ kb_Data[i];
+        key_up[i]   = ( last_pressed[i]) & pressed_or_released[i];
+        key_down[i] = (~last_pressed[i]) & pressed_or_released[i];
+        key_held[i] = kb_Data[i];
+        last_pressed[i] = kb_Data[i];
+        
+        for(u8 bit_index = 0; bit_index < 8; ++bit_index) {
+            u8 mask = (u8)((u8)1 << bit_index);
+            
+            if(key_down[i] & mask) {
+                key_debounced[i] |= mask;
+                key_repeat_clock[i][bit_index] = now + cast(u24)KEY_REPEAT_DELAY_CLOCK_CYCLES;
+                key_repeats[i][bit_index] = 0;
+            } else if((key_held[i] & mask) && cast(s24)(now - key_repeat_clock[i][bit_index]) >= 0) {
+                key_debounced[i] |= mask;
+                s24 interval = KEY_REPEAT_INTERVAL_CLOCK_CYCLES;
+                if(i == 7 && (mask & (kb_Down | kb_Left | kb_Right | kb_Up))) {
+                    interval = max(ARROW_REPEAT_FASTEST_CLOCK_CYCLES,
+                                   interval - key_repeats[i][bit_index]*ARROW_REPEAT_SPEEDUP_CLOCK_CYCLES);
+                    if(key_repeats[i][bit_index] < 255) {
+                        key_repeats[i][bit_index] += 1;
+                    }
+                }
+                // NOTE: From now, so an update that took long doesn't make it repeat several ticks in a row
+                key_repeat_clock[i][bit_index] = now + cast(u24)interval;
             } else {
                 key_debounced[i] &= (~mask);
             }
@@ -994,64 +2246,20 @@ void update_input(void) {
     }
 }
 
-void offset_linebreaks(s24 from_here, s24 offset_by) {
-    for(int i = program.linebreaks_count - 1; i >= 0; --i) {
-        if(get_linebreak_location(i) >= from_here) { program.linebreaks[i].location_ += offset_by; }
-        else { break; }
-    }
-}
-
-void make_room_for_tokens(s24 first_index, s24 count) {
-    // NOTE: iterate backwards so we copy things forwards
-    // Initially this function was only this following for loop,
-    // but after unrolling the loop,
-    // the editor is noticably faster at inserting tokens with large programs.
-    // for(int i = program.size - 1; i >= first_index + count; --i) {
-    //     program.data[i] = program.data[i - count];
-    // }
-
-    s24 max = program.size - 1;
-    s24 min = first_index + count;
-    s24 iterate_count = (max + 1) - min;
-    s24 iterate_count_divided_by_4 = iterate_count / 4;
-    s24 iterate_count_remainder = iterate_count - (iterate_count_divided_by_4 * 4);
-    s24 it = max;
-    while(iterate_count_divided_by_4 >= 1) {
-        program.data[it - 0] = program.data[it - (count + 0)];
-        program.data[it - 1] = program.data[it - (count + 1)];
-        program.data[it - 2] = program.data[it - (count + 2)];
-        program.data[it - 3] = program.data[it - (count + 3)];
-        it -= 4;
-        iterate_count_divided_by_4 -= 1;
-    }
-    while(iterate_count_remainder >= 1) {
-        program.data[it] = program.data[it - count];
-        it -= 1;
-        iterate_count_remainder -= 1;
-    }
-}
-
-// NOTE: Returns index of first linebreak that can be added
-s24 make_room_for_linebreaks(s24 first_linebreaks_program_data_index, s24 count) {
-    s24 result = -2;
-    
-    assert(count >= 1, "No room needed for linebreaks");
-    for(s24 i = program.linebreaks_count - 1; i >= 0; --i) {
-        if(get_linebreak_location(i) < first_linebreaks_program_data_index)
-        {
-            result = i+1;
-            break;
-        }
+// NOTE: update() only does anything in response to keys, so when nothing is held it can be skipped.
+// Releasing a key doesn't do anything either, so key_up isn't checked.
+bool any_key_held(void) {
+    bool result = on_held;
+    for(u8 i = 1; i < 8; i++) {
+        if(key_held[i] != 0) { result = true; }
     }
-    assert(result != -2, "failed");
-    // NOTE: So result should be the index that we can set fresh values to.
-    // Push future elements later in array
-    program.linebreaks_count += count;
-    for(s24 i = program.linebreaks_count - 1; i >= result + count; --i) {
-        program.linebreaks[i] = program.linebreaks[i - count];
+    return result;
+}
+bool any_key_pressed(void) {
+    bool result = on_pressed;
+    for(u8 i = 1; i < 8; i++) {
+        if(key_down[i] != 0) { result = true; }
     }
-
-    assert(result <= (program.linebreaks_count - 1) && result >= 1, "out-of-bounds");
     return result;
 }
 
@@ -1061,184 +2269,1517 @@ void copy(void *src, void *dest, s24 count) {
     }
 }
 
-void zero(void *dest, s24 count) {
-    for(s24 i = 0; i < count; ++i) {
-        ((u8*)dest)[i] = 0;
+// NOTE: Like copy, but src and dest may overlap.
+// The libc memmove is an ldir/lddr, which is a lot faster than a byte loop.
+void copy_overlapping(void *src, void *dest, s24 count) {
+    if(count > 0) {
+        memmove(dest, src, cast(size_t)count);
+    }
+}
+
+void zero(void *dest, s24 count) {
+    for(s24 i = 0; i < count; ++i) {
+        ((u8*)dest)[i] = 0;
+    }
+}
+
+// NOTE: Returns the line token_offset is on, which is the last linebreak before it.
+// Linebreak locations are sorted so this is a binary search.
+s24 calculate_line_y(s24 token_offset) {
+    if(token_offset <= get_linebreak_location(0)) {
+        return -1;
+    }
+    s24 low = 0;
+    s24 high = program.linebreaks_count - 1;
+    while(low < high) {
+        s24 middle = low + (high - low + 1) / 2;
+        if(get_linebreak_location(middle) < token_offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+bool line_contains_offset(s24 line, s24 token_offset) {
+    bool result = false;
+    if(line >= 0 && line <= program.linebreaks_count - 1) {
+        result = get_linebreak_location(line) < token_offset &&
+                 (line == program.linebreaks_count - 1 || token_offset <= get_linebreak_location(line + 1));
+    }
+    return result;
+}
+
+// NOTE: The cursor is almost always on the line it was on last time, or on a line next to it,
+// so check those before falling back to the binary search.
+s24 calculate_cursor_y(void) {
+    s24 result = program.cursor_y_cache;
+    if(!line_contains_offset(result, program.cursor)) {
+        if(line_contains_offset(result + 1, program.cursor)) {
+            result += 1;
+        } else if(line_contains_offset(result - 1, program.cursor)) {
+            result -= 1;
+        } else {
+            result = calculate_line_y(program.cursor);
+        }
+        program.cursor_y_cache = result;
+    }
+    return result;
+}
+
+// NOTE: How many characters the token at pos takes up on screen
+s24 get_token_width(s24 pos) {
+    s24 result = 1;
+    u8 byte = get_program_byte(pos);
+    if(byte == LINEBREAK) {
+        result = 0;
+    } else if(byte != SPACE) {
+        u24 str_length;
+        char *unused = get_token_string(get_program_token_pointer(pos), &str_length);
+        I_KNOW_ITS_UNUSED(unused);
+        result = cast(s24)str_length;
+    }
+    return result;
+}
+
+// NOTE: Returns where the line ends, which is its linebreak or the end of the program
+s24 get_line_end(s24 line) {
+    s24 result = program.size;
+    if(line + 1 <= program.linebreaks_count - 1) {
+        result = get_linebreak_location(line + 1);
+    }
+    return result;
+}
+
+// NOTE: Returns the index of the last checkpoint at or before offset, or -1 if there's none
+s24 find_line_checkpoint(s24 offset) {
+    s24 low = -1;
+    s24 high = program.line_checkpoints_count - 1;
+    while(low < high) {
+        s24 middle = low + (high - low + 1) / 2;
+        if(cast(s24)program.line_checkpoints[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// NOTE: Like offset_linebreaks. Checkpoints that were before line_end are on the edited line,
+// so their column moves by column_by too.
+void offset_line_checkpoints(s24 from_here, s24 offset_by, s24 line_end, s24 column_by) {
+    for(s24 i = program.line_checkpoints_count - 1; i >= 0; --i) {
+        LineCheckpoint *checkpoint = program.line_checkpoints + i;
+        if(cast(s24)checkpoint->offset < from_here) { break; }
+        if(cast(s24)checkpoint->offset < line_end) { checkpoint->column = cast(u16)(checkpoint->column + column_by); }
+        checkpoint->offset = cast(u16)(checkpoint->offset + offset_by);
+    }
+}
+
+// NOTE: Removes the checkpoints with offsets in [first_offset, last_offset]
+void drop_line_checkpoints(s24 first_offset, s24 last_offset) {
+    s24 first = find_line_checkpoint(first_offset - 1) + 1;
+    s24 last = find_line_checkpoint(last_offset);
+    if(last >= first) {
+        s24 count = last - first + 1;
+        copy_overlapping(program.line_checkpoints + last + 1, program.line_checkpoints + first,
+                         (program.line_checkpoints_count - (last + 1)) * cast(s24)sizeof(LineCheckpoint));
+        program.line_checkpoints_count -= count;
+    }
+}
+
+// NOTE: Walks the whole line to put its checkpoints back and work out its width, which it returns.
+// Lines that are too wide for a u16 keep LINE_WIDTH_UNKNOWN and get walked every time.
+s24 index_line_checkpoints(s24 line) {
+    s24 line_start = get_linebreak_location(line) + 1;
+    s24 line_end = get_line_end(line);
+    drop_line_checkpoints(line_start, line_end);
+
+    s24 tokens_count = 0;
+    for(s24 i = line_start; i < line_end; i += get_token_size(i)) {
+        tokens_count += 1;
+    }
+    s24 wanted = 0;
+    if(tokens_count >= 1) { wanted = (tokens_count - 1) / LINE_CHECKPOINT_SPACING; }
+    wanted = min(wanted, cast(s24)ARRLEN(program.line_checkpoints) - program.line_checkpoints_count);
+
+    s24 first = find_line_checkpoint(line_start - 1) + 1;
+    copy_overlapping(program.line_checkpoints + first, program.line_checkpoints + first + wanted,
+                     (program.line_checkpoints_count - first) * cast(s24)sizeof(LineCheckpoint));
+    program.line_checkpoints_count += wanted;
+
+    s24 column = 0;
+    s24 added = 0;
+    s24 token_index = 0;
+    for(s24 i = line_start; i < line_end; i += get_token_size(i), ++token_index) {
+        if(token_index != 0 && token_index % LINE_CHECKPOINT_SPACING == 0 && added < wanted && column < LINE_WIDTH_UNKNOWN) {
+            program.line_checkpoints[first + added].offset = cast(u16)i;
+            program.line_checkpoints[first + added].column = cast(u16)column;
+            added += 1;
+        }
+        column += get_token_width(i);
+    }
+    if(added < wanted) {
+        copy_overlapping(program.line_checkpoints + first + wanted, program.line_checkpoints + first + added,
+                         (program.line_checkpoints_count - (first + wanted)) * cast(s24)sizeof(LineCheckpoint));
+        program.line_checkpoints_count -= wanted - added;
+    }
+
+    get_linebreak(line)->width = (column < LINE_WIDTH_UNKNOWN) ? cast(u16)column : LINE_WIDTH_UNKNOWN;
+    return column;
+}
+
+s24 get_line_width(s24 line) {
+    s24 result = get_linebreak(line)->width;
+    if(result == LINE_WIDTH_UNKNOWN) {
+        result = index_line_checkpoints(line);
+    }
+    return result;
+}
+
+// NOTE: Returns how many characters come before offset in the line, not counting indentation.
+// offset should be the start of a token in the line, or the end of the line.
+s24 get_column_of_offset(s24 line, s24 offset) {
+    s24 result = 0;
+    if(offset >= get_line_end(line)) {
+        result = get_line_width(line);
+    } else {
+        s24 i = get_linebreak_location(line) + 1;
+        s24 checkpoint = find_line_checkpoint(offset);
+        if(checkpoint >= 0 && cast(s24)program.line_checkpoints[checkpoint].offset >= i) {
+            i = program.line_checkpoints[checkpoint].offset;
+            result = program.line_checkpoints[checkpoint].column;
+        }
+        s24 walked = 0;
+        for(; i < offset; i += get_token_size(i), ++walked) {
+            result += get_token_width(i);
+        }
+        if(walked > 2*LINE_CHECKPOINT_SPACING) {
+            index_line_checkpoints(line);
+        }
+    }
+    return result;
+}
+
+// NOTE: Returns the offset of the last checkpoint in the line starting at or before column, or the start
+// of the line if there's none. *offset_column gets the column that offset is at.
+s24 find_column_in_line(s24 line, s24 column, s24 *offset_column) {
+    s24 line_start = get_linebreak_location(line) + 1;
+    s24 result = line_start;
+    *offset_column = 0;
+    s24 low = find_line_checkpoint(line_start - 1) + 1;
+    s24 high = find_line_checkpoint(get_line_end(line) - 1);
+    if(low <= high && program.line_checkpoints[low].column <= column) {
+        while(low < high) {
+            s24 middle = low + (high - low + 1) / 2;
+            if(cast(s24)program.line_checkpoints[middle].column <= column) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+        result = program.line_checkpoints[low].offset;
+        *offset_column = program.line_checkpoints[low].column;
+    }
+    return result;
+}
+
+// NOTE: Lines that render() has to repaint next frame.
+// Pass LAST_LINE_POSSIBLE as last_line when lines were added or removed, since everything below moves.
+void mark_lines_dirty(s24 first_line, s24 last_line) {
+    program.dirty_line_min = min(program.dirty_line_min, first_line);
+    program.dirty_line_max = max(program.dirty_line_max, last_line);
+}
+
+IndentationStep get_byte_indentation_step(u8 byte) {
+    IndentationStep result = {0, 0};
+    if(byte == 0xCF || (byte >= 0xD1 && byte <= 0xD3)) {
+        result.change = 1;
+    } else if(byte == 0xD4) {
+        result.change = -1;
+    }
+    return result;
+}
+
+// NOTE: first, then second
+IndentationStep chain_indentation_steps(IndentationStep first, IndentationStep second) {
+    IndentationStep result;
+    result.change = cast(s16)(first.change + second.change);
+    result.floor = cast(u16)max(cast(s24)first.floor + second.change, cast(s24)second.floor);
+    return result;
+}
+
+s24 apply_indentation_step(IndentationStep step, s24 indentation) {
+    return max(indentation + step.change, cast(s24)step.floor);
+}
+
+// NOTE: A line's change is -2 to 2 and its floor 0 or 1
+u8 pack_indentation_step(IndentationStep step) {
+    return cast(u8)((step.change + 2) + step.floor*5);
+}
+
+IndentationStep unpack_indentation_step(u8 packed) {
+    IndentationStep result;
+    result.change = cast(s16)(packed % 5) - 2;
+    result.floor = packed / 5;
+    return result;
+}
+
+// NOTE: Only the first and last byte of a line count, so If ...:Then and End indent and unindent
+IndentationStep read_line_indentation_step(s24 line) {
+    IndentationStep result = {0, 0};
+    s24 first_loc = get_linebreak_location(line) + 1;
+    // NOTE: The last line has no linebreak after it, it ends with the program
+    s24 second_loc = program.size - 1;
+    if(line + 1 <= program.linebreaks_count - 1) { second_loc = get_linebreak_location(line + 1) - 1; }
+    if(first_loc <= second_loc) {
+        result = get_byte_indentation_step(get_program_byte(first_loc));
+        if(second_loc != first_loc) {
+            result = chain_indentation_steps(result, get_byte_indentation_step(get_program_byte(second_loc)));
+        }
+    }
+    return result;
+}
+
+void chain_line_block(s24 index) {
+    LineBlock *block = &program.line_blocks[index];
+    IndentationStep step = {0, 0};
+    for(u8 i = 0; i < block->count; ++i) {
+        step = chain_indentation_steps(step, unpack_indentation_step(block->lines[i].indentation_step));
+    }
+    program.indentation_tree[program.line_blocks_capacity + index] = step;
+}
+
+// NOTE: The nodes above blocks first_block to last_block
+void chain_indentation_tree(s24 first_block, s24 last_block) {
+    s24 first_node = program.line_blocks_capacity + first_block;
+    s24 last_node = program.line_blocks_capacity + last_block;
+    while(first_node > 1) {
+        first_node /= 2;
+        last_node /= 2;
+        for(s24 node = first_node; node <= last_node; ++node) {
+            program.indentation_tree[node] = chain_indentation_steps(program.indentation_tree[node*2], program.indentation_tree[node*2 + 1]);
+        }
+    }
+}
+
+// NOTE: Call when the text of lines first_line to last_line changed, or they were just added
+void update_line_indentation(s24 first_line, s24 last_line) {
+    last_line = min(last_line, program.linebreaks_count - 1);
+    for(s24 line = first_line; line <= last_line; ++line) {
+        get_linebreak(line)->indentation_step = pack_indentation_step(read_line_indentation_step(line));
+    }
+    s24 first_block = find_line_block(first_line);
+    s24 last_block = find_line_block(last_line);
+    for(s24 block = first_block; block <= last_block; ++block) {
+        chain_line_block(block);
+    }
+    chain_indentation_tree(first_block, last_block);
+}
+
+// NOTE: Goes down the tree to the line's block, going through the blocks on the left on the way, then through
+// the lines before it in the block.
+s24 get_line_indentation(s24 line) {
+    s24 result = 0;
+    s24 block = find_line_block(line);
+    s24 node = 1;
+    s24 node_first_block = 0;
+    s24 node_blocks = program.line_blocks_capacity;
+    while(node_blocks > 1) {
+        node_blocks /= 2;
+        if(block >= node_first_block + node_blocks) {
+            result = apply_indentation_step(program.indentation_tree[node*2], result);
+            node = node*2 + 1;
+            node_first_block += node_blocks;
+        } else {
+            node = node*2;
+        }
+    }
+    LineBlock *line_block = &program.line_blocks[block];
+    for(s24 i = 0; i < line - line_block->first_line; ++i) {
+        result = apply_indentation_step(unpack_indentation_step(line_block->lines[i].indentation_step), result);
+    }
+    return result;
+}
+
+// NOTE: Makes line_blocks and indentation_tree room for at least blocks blocks, doubling them until they have.
+// The tree is chained again for its new size.
+bool grow_line_blocks(s24 blocks) {
+    s24 capacity = max(LINE_BLOCKS_MIN, program.line_blocks_capacity);
+    while(capacity < blocks) {
+        capacity *= 2;
+    }
+    LineBlock *line_blocks = malloc(sizeof(LineBlock)*cast(size_t)capacity);
+    IndentationStep *indentation_tree = malloc(sizeof(IndentationStep)*cast(size_t)capacity*2);
+    bool result = line_blocks != null && indentation_tree != null;
+    if(result) {
+        zero(indentation_tree, cast(s24)sizeof(IndentationStep)*capacity*2);
+        if(program.line_blocks) {
+            copy(program.line_blocks, line_blocks, program.line_blocks_count * cast(s24)sizeof(LineBlock));
+            copy(program.indentation_tree + program.line_blocks_capacity, indentation_tree + capacity,
+                 program.line_blocks_count * cast(s24)sizeof(IndentationStep));
+            free(program.line_blocks);
+            free(program.indentation_tree);
+        }
+        program.line_blocks = line_blocks;
+        program.indentation_tree = indentation_tree;
+        program.line_blocks_capacity = capacity;
+        if(program.line_blocks_count > 0) {
+            chain_indentation_tree(0, program.line_blocks_count - 1);
+        }
+    } else {
+        free(line_blocks);
+        free(indentation_tree);
+    }
+    return result;
+}
+
+// NOTE: Makes sure count linebreaks can be added anywhere, so adding them can't run out of blocks halfway.
+// Adding them fills the rest of one block and splits it, which takes a block for the split off part
+// and one for each LINE_BLOCK_LINES added.
+bool reserve_linebreaks(s24 count) {
+    s24 needed = count / LINE_BLOCK_LINES + 2;
+    bool result = program.line_blocks_count + needed <= program.line_blocks_capacity ||
+                  grow_line_blocks(program.line_blocks_count + needed);
+    while(result && program.free_line_blocks_count < needed) {
+        Linebreak *lines = malloc(sizeof(Linebreak)*LINE_BLOCK_LINES);
+        if(lines) {
+            *cast(Linebreak**)lines = program.free_line_blocks;
+            program.free_line_blocks = lines;
+            program.free_line_blocks_count += 1;
+        } else {
+            result = false;
+        }
+    }
+    return result;
+}
+
+// NOTE: Gives the heap back what reserve_linebreaks took and isn't used, keeping a couple for the next edits
+void trim_free_line_blocks(void) {
+    while(program.free_line_blocks_count > 2) {
+        Linebreak *lines = program.free_line_blocks;
+        program.free_line_blocks = *cast(Linebreak**)lines;
+        program.free_line_blocks_count -= 1;
+        free(lines);
+    }
+}
+
+// NOTE: An empty block at index. The caller sets it up and fixes the first_line of the blocks after.
+void insert_line_block(s24 index) {
+    assert(program.free_line_blocks != null && program.line_blocks_count < program.line_blocks_capacity, "Call reserve_linebreaks first");
+    copy_overlapping(program.line_blocks + index, program.line_blocks + index + 1,
+                     (program.line_blocks_count - index) * cast(s24)sizeof(LineBlock));
+    copy_overlapping(program.indentation_tree + program.line_blocks_capacity + index, program.indentation_tree + program.line_blocks_capacity + index + 1,
+                     (program.line_blocks_count - index) * cast(s24)sizeof(IndentationStep));
+    program.line_blocks_count += 1;
+    LineBlock *block = &program.line_blocks[index];
+    block->lines = program.free_line_blocks;
+    program.free_line_blocks = *cast(Linebreak**)block->lines;
+    program.free_line_blocks_count -= 1;
+    block->count = 0;
+    block->base = program.line_blocks[index - 1].base;
+    block->first_line = program.line_blocks[index - 1].first_line + program.line_blocks[index - 1].count;
+    program.indentation_tree[program.line_blocks_capacity + index] = (IndentationStep){0, 0};
+}
+
+void remove_line_block(s24 index) {
+    Linebreak *lines = program.line_blocks[index].lines;
+    *cast(Linebreak**)lines = program.free_line_blocks;
+    program.free_line_blocks = lines;
+    program.free_line_blocks_count += 1;
+    copy_overlapping(program.line_blocks + index + 1, program.line_blocks + index,
+                     (program.line_blocks_count - index - 1) * cast(s24)sizeof(LineBlock));
+    copy_overlapping(program.indentation_tree + program.line_blocks_capacity + index + 1, program.indentation_tree + program.line_blocks_capacity + index,
+                     (program.line_blocks_count - index - 1) * cast(s24)sizeof(IndentationStep));
+    program.line_blocks_count -= 1;
+    program.indentation_tree[program.line_blocks_capacity + program.line_blocks_count] = (IndentationStep){0, 0};
+}
+
+// NOTE: Moves the block's base to its first linebreak after that one changed
+void rebase_line_block(s24 index) {
+    LineBlock *block = &program.line_blocks[index];
+    s24 moved_by = cast(s24)block->lines[0].location_;
+    block->base += moved_by;
+    for(u8 i = 0; i < block->count; ++i) {
+        block->lines[i].location_ = cast(u16)(block->lines[i].location_ - moved_by);
+    }
+}
+
+void renumber_line_blocks(s24 from_block) {
+    for(s24 i = max(1, from_block); i <= program.line_blocks_count - 1; ++i) {
+        program.line_blocks[i].first_line = program.line_blocks[i - 1].first_line + program.line_blocks[i - 1].count;
+    }
+}
+
+// NOTE: Empties the line index down to line 0, which has to be there
+bool reset_linebreaks(void) {
+    while(program.line_blocks_count > 1) {
+        remove_line_block(program.line_blocks_count - 1);
+    }
+    bool result = true;
+    if(program.line_blocks_count == 0) {
+        result = reserve_linebreaks(0);
+        if(result) {
+            LineBlock *block = &program.line_blocks[0];
+            block->lines = program.free_line_blocks;
+            program.free_line_blocks = *cast(Linebreak**)block->lines;
+            program.free_line_blocks_count -= 1;
+            program.line_blocks_count = 1;
+        }
+    }
+    if(result) {
+        LineBlock *block = &program.line_blocks[0];
+        block->first_line = 0;
+        block->base = 0;
+        block->count = 1;
+        block->lines[0].location_ = 0;
+        block->lines[0].indentation = 0;
+        block->lines[0].indentation_step = pack_indentation_step((IndentationStep){0, 0});
+        block->lines[0].width = LINE_WIDTH_UNKNOWN;
+        program.linebreaks_count = 1;
+        program.line_block_cache = 0;
+        zero(program.indentation_tree, cast(s24)sizeof(IndentationStep)*program.line_blocks_capacity*2);
+    }
+    return result;
+}
+
+// NOTE: Gives every block back to the heap
+void release_linebreaks(void) {
+    while(program.line_blocks_count > 0) {
+        remove_line_block(program.line_blocks_count - 1);
+    }
+    while(program.free_line_blocks) {
+        Linebreak *lines = program.free_line_blocks;
+        program.free_line_blocks = *cast(Linebreak**)lines;
+        free(lines);
+    }
+    program.free_line_blocks_count = 0;
+    program.linebreaks_count = 0;
+    free(program.line_blocks);
+    free(program.indentation_tree);
+    program.line_blocks = null;
+    program.indentation_tree = null;
+    program.line_blocks_capacity = 0;
+}
+
+void offset_linebreaks(s24 from_here, s24 offset_by) {
+    s24 first = calculate_line_y(from_here) + 1;
+    if(first <= program.linebreaks_count - 1) {
+        s24 index = find_line_block(first);
+        LineBlock *block = &program.line_blocks[index];
+        s24 at = first - block->first_line;
+        if(at == 0) {
+            block->base += offset_by;
+        } else {
+            for(s24 i = at; i < block->count; ++i) { block->lines[i].location_ += offset_by; }
+        }
+        for(s24 i = index + 1; i <= program.line_blocks_count - 1; ++i) {
+            program.line_blocks[i].base += offset_by;
+        }
+    }
+}
+
+// NOTE: Returns index of first linebreak that can be added. They go in the block of the line before them,
+// and if they don't fit, the linebreaks after them are split off into a block of their own
+// and they fill this block and as many new blocks as they need. See reserve_linebreaks.
+s24 make_room_for_linebreaks(s24 first_linebreaks_program_data_index, s24 count) {
+    assert(count >= 1, "No room needed for linebreaks");
+    s24 result = calculate_line_y(first_linebreaks_program_data_index) + 1;
+    s24 index = find_line_block(result - 1);
+    LineBlock *block = &program.line_blocks[index];
+    s24 at = result - block->first_line;
+    s24 after_count = block->count - at;
+    if(block->count + count <= LINE_BLOCK_LINES) {
+        copy_overlapping(block->lines + at, block->lines + at + count, after_count * cast(s24)sizeof(Linebreak));
+        block->count += count;
+    } else {
+        s24 next = index + 1;
+        if(after_count > 0) {
+            insert_line_block(next);
+            LineBlock *after = &program.line_blocks[next];
+            copy(block->lines + at, after->lines, after_count * cast(s24)sizeof(Linebreak));
+            after->count = cast(u8)after_count;
+            after->base = block->base;
+            rebase_line_block(next);
+            chain_line_block(next);
+            block->count = cast(u8)at;
+        }
+        s24 left = count;
+        s24 filling = min(left, LINE_BLOCK_LINES - block->count);
+        block->count += filling;
+        left -= filling;
+        while(left > 0) {
+            insert_line_block(next);
+            program.line_blocks[next].count = cast(u8)min(left, LINE_BLOCK_LINES);
+            left -= program.line_blocks[next].count;
+            next += 1;
+        }
+        chain_indentation_tree(0, program.line_blocks_count - 1);
+    }
+    program.linebreaks_count += count;
+    renumber_line_blocks(index + 1);
+    if(program.cursor_y_cache >= result) {
+        program.cursor_y_cache += count;
+    }
+
+    assert(result <= (program.linebreaks_count - 1) && result >= 1, "out-of-bounds");
+    return result;
+}
+
+// NOTE: Removes lines first_line to first_line + count - 1, and joins the block left with the one after it
+// if they fit in one
+void remove_linebreaks(s24 first_line, s24 count) {
+    assert(first_line >= 1, "Line 0 stays");
+    s24 first_index = find_line_block(first_line);
+    s24 index = first_index;
+    s24 at = first_line - program.line_blocks[index].first_line;
+    s24 left = count;
+    while(left > 0) {
+        LineBlock *block = &program.line_blocks[index];
+        s24 removing = min(left, block->count - at);
+        copy_overlapping(block->lines + at + removing, block->lines + at, (block->count - at - removing) * cast(s24)sizeof(Linebreak));
+        block->count -= removing;
+        left -= removing;
+        if(block->count == 0) {
+            remove_line_block(index);
+        } else {
+            if(at == 0) { rebase_line_block(index); }
+            chain_line_block(index);
+            index += 1;
+        }
+        at = 0;
+    }
+    program.linebreaks_count -= count;
+    renumber_line_blocks(first_index);
+
+    s24 joined = find_line_block(first_line - 1);
+    if(joined + 1 <= program.line_blocks_count - 1 &&
+       program.line_blocks[joined].count + program.line_blocks[joined + 1].count <= LINE_BLOCK_LINES) {
+        LineBlock *block = &program.line_blocks[joined];
+        LineBlock *next = &program.line_blocks[joined + 1];
+        for(u8 i = 0; i < next->count; ++i) {
+            block->lines[block->count + i] = next->lines[i];
+            block->lines[block->count + i].location_ = cast(u16)(next->base + next->lines[i].location_ - block->base);
+        }
+        block->count += next->count;
+        remove_line_block(joined + 1);
+        chain_line_block(joined);
+    }
+    chain_indentation_tree(0, program.line_blocks_count - 1);
+}
+
+// NOTE: Call after changing the program, with `inserted` bytes at `at` now being new.
+// Keeps track of what save_program has to write.
+void note_program_edit(s24 at, s24 inserted) {
+    program.edit_generation += 1;
+    program.unchanged_prefix = min(program.unchanged_prefix, at);
+    program.unchanged_suffix = min(program.unchanged_suffix, program.size - (at + inserted));
+}
+
+// NOTE: Returns the index of the first label at or after offset
+s24 find_label(s24 offset) {
+    s24 low = 0;
+    s24 high = program.labels_count;
+    while(low < high) {
+        s24 mid = (low + high) / 2;
+        if(cast(s24)program.labels[mid] < offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void add_label(s24 index, s24 offset) {
+    if(program.labels_count == LABELS_MAX) {
+        program.labels_overflowed = true;
+    } else {
+        copy_overlapping(program.labels + index, program.labels + index + 1, (program.labels_count - index)*cast(s24)sizeof(u16));
+        program.labels[index] = cast(u16)offset;
+        program.labels_count += 1;
+        program.labels_by_name_dirty = true;
+    }
+}
+
+// NOTE: A label's name is the two bytes after it, so an edit at `at` may rename the labels right before it
+void note_label_names_edited(s24 at) {
+    s24 index = find_label(at - 2);
+    if(index <= program.labels_count - 1 && cast(s24)program.labels[index] < at) {
+        program.labels_by_name_dirty = true;
+    }
+}
+
+// NOTE: Call after removing bytes_count bytes at `at`
+void remove_labels(s24 at, s24 bytes_count) {
+    note_label_names_edited(at);
+    s24 first = find_label(at);
+    s24 end = find_label(at + bytes_count);
+    if(end > first) {
+        copy_overlapping(program.labels + end, program.labels + first, (program.labels_count - end)*cast(s24)sizeof(u16));
+        program.labels_count -= end - first;
+        program.labels_by_name_dirty = true;
+    }
+    for(s24 i = first; i <= program.labels_count - 1; ++i) {
+        program.labels[i] -= cast(u16)bytes_count;
+    }
+}
+
+// NOTE: Call after inserting bytes_count bytes at `at`
+void insert_labels(s24 at, s24 bytes_count) {
+    note_label_names_edited(at);
+    s24 index = find_label(at);
+    for(s24 i = index; i <= program.labels_count - 1; ++i) {
+        program.labels[i] += cast(u16)bytes_count;
+    }
+    for(s24 i = at; i < at + bytes_count; i += get_token_size(i)) {
+        if(get_program_byte(i) == LBL) {
+            add_label(index, i);
+            index += 1;
+        }
+    }
+}
+
+// NOTE: push_delta may be null if you do not want to push to an undo/redo buffer
+void remove_tokens_(s24 at, u16 bytes_count, DeltaCollection* push_delta) {
+    require_full_index();
+    if(at < 0) {
+        bytes_count += at;
+        at = 0;
+    }
+
+    if(at <= program.size - 1) {
+        s24 max = at + bytes_count - 1;
+        if(max >= program.size) {
+            max = program.size - 1;
+            s24 new_count = ((max - at) + 1);
+            assert(new_count >= 0 && new_count <= 65536, "Must be within u16 range");
+            bytes_count = cast(u16)new_count;
+        }
+        if(bytes_count > PROGRAM_MAX_EDIT_SIZE && program.windowed) {
+            // NOTE: Too much to have in the window at once, so it goes a piece at a time from the end,
+            // cut between tokens
+            s24 end = at + bytes_count;
+            s24 piece_start = at;
+            while(piece_start < end - PROGRAM_MAX_EDIT_SIZE) {
+                piece_start += get_token_size(piece_start);
+            }
+            remove_tokens_(piece_start, cast(u16)(end - piece_start), push_delta);
+            bytes_count = cast(u16)(piece_start - at);
+        }
+        if(bytes_count != 0 && !fit_program_window(at, at + bytes_count, 0)) {
+            assert(false, "Couldn't fit removal in the window");
+            bytes_count = 0;
+        }
+        if(bytes_count != 0) {
+            s24 line = calculate_line_y(at);
+            s24 line_end = get_line_end(line);
+            s24 removed_width = 0;
+            for(s24 i = at; i < at + bytes_count; i += get_token_size(i)) {
+                removed_width += get_token_width(i);
+            }
+
+            // NOTE: With the gap at `at`, the bytes being removed are contiguous right after the gap
+            move_program_gap(at);
+            u8 *removing = program.data + program.gap_end;
+            if(push_delta) {
+                push_remove_delta(push_delta, program.cursor, at, removing, bytes_count);
+            }
+
+            s24 linebreaks_count = 0;
+            for(s24 i = 0; i <= bytes_count - 1; i += get_token_size_from_first_byte(removing[i])) {
+                if(removing[i] == LINEBREAK) {
+                    linebreaks_count += 1;
+                }
+            }
+            s24 first_linebreak = calculate_line_y(at) + 1;
+
+            if(linebreaks_count >= 1) {
+                remove_linebreaks(first_linebreak, linebreaks_count);
+                if(program.cursor_y_cache >= first_linebreak + linebreaks_count) {
+                    program.cursor_y_cache -= linebreaks_count;
+                } else if(program.cursor_y_cache >= first_linebreak) {
+                    program.cursor_y_cache = first_linebreak - 1;
+                }
+            }
+
+            program.gap_end += bytes_count;
+            offset_linebreaks(at, -1 * cast(s24)bytes_count);
+            program.size -= bytes_count;
+
+            drop_line_checkpoints(at, at + bytes_count - 1);
+            offset_line_checkpoints(at + bytes_count, -1 * cast(s24)bytes_count, line_end, -removed_width);
+            remove_labels(at, bytes_count);
+            if(linebreaks_count >= 1) {
+                // NOTE: Lines got joined, so the columns of everything after `at` changed
+                drop_line_checkpoints(get_linebreak_location(line) + 1, get_line_end(line));
+                get_linebreak(line)->width = LINE_WIDTH_UNKNOWN;
+                trim_free_line_blocks();
+            } else if(get_linebreak(line)->width != LINE_WIDTH_UNKNOWN) {
+                get_linebreak(line)->width = cast(u16)(get_linebreak(line)->width - removed_width);
+            }
+
+            note_program_edit(at, 0);
+            update_line_indentation(first_linebreak - 1, first_linebreak - 1);
+            mark_lines_dirty(first_linebreak - 1, (linebreaks_count >= 1) ? LAST_LINE_POSSIBLE : first_linebreak - 1);
+        }
+
+    }
+}
+
+// NOTE: Typing tokens one after another, or deleting them with repeated DELs, is merged into one undo delta
+// as long as the keystrokes touch and come less than UNDO_MERGE_MILLISECONDS apart.
+// Only single token edits merge, and a linebreak ends the run, so undo still goes at most a line at a time.
+#define UNDO_MERGE_MILLISECONDS (1000)
+#define UNDO_MERGE_CLOCK_CYCLES ((UNDO_MERGE_MILLISECONDS*CLOCKS_PER_SEC)/1000)
+#define UNDO_MERGE_MAX_BYTES 64
+
+// NOTE: Whether an edit of these bytes is a single token edit that can be merged with its neighbours.
+// tokens may be null for edits that can't.
+bool is_mergeable_edit(u8 *tokens, u16 count) {
+    bool result = tokens != null && count >= 1 && count <= 2;
+    for(u16 i = 0; result && i < count; i += get_token_size_from_first_byte(tokens[i])) {
+        if(tokens[i] == LINEBREAK) { result = false; }
+    }
+    return result;
+}
+
+// NOTE: Returns the newest undo delta if an edit of these bytes may be merged into it
+Delta* get_mergeable_undo_delta(u8 *tokens, u16 count) {
+    Delta *result = 0;
+    u24 now = cast(u24)clock();
+    if(program.undo_merge_open && program.undo_buffer.delta_count > 0 && is_mergeable_edit(tokens, count) &&
+        (now - program.undo_merge_clock) < cast(u24)UNDO_MERGE_CLOCK_CYCLES) {
+        result = cast(Delta*)(program.undo_buffer.data + program.undo_buffer.newest);
+    }
+    return result;
+}
+
+void after_undoable_edit(u8 *tokens, u16 count) {
+    clear_delta_collection(&program.redo_buffer);
+    program.undo_merge_open = is_mergeable_edit(tokens, count);
+    program.undo_merge_clock = cast(u24)clock();
+}
+
+void remove_tokens(s24 at, u16 bytes_count) {
+    u8 removing_[2];
+    u8 *removing = null;
+    if(at >= 0 && bytes_count <= 2 && at + bytes_count <= program.size) {
+        for(u16 i = 0; i < bytes_count; ++i) {
+            removing_[i] = get_program_byte(at + i);
+        }
+        removing = removing_;
+    }
+    bool merged = false;
+    Delta *newest = get_mergeable_undo_delta(removing, bytes_count);
+    if(newest && newest->type == Delta_RemoveTokens && newest->remove_data.count + bytes_count <= UNDO_MERGE_MAX_BYTES) {
+        u8 *data = (cast(u8*)newest) + sizeof(Delta);
+        if(newest->remove_data.at == at) {
+            // NOTE: DEL again at the same place, the removed tokens go after the ones removed before
+            if(grow_newest_delta(&program.undo_buffer, bytes_count)) {
+                copy(removing, data + newest->remove_data.count, bytes_count);
+                newest->remove_data.count += bytes_count;
+                merged = true;
+            }
+        } else if(at + bytes_count == newest->remove_data.at) {
+            // NOTE: Removing backwards, the removed tokens go before the ones removed before
+            if(grow_newest_delta(&program.undo_buffer, bytes_count)) {
+                copy_overlapping(data, data + bytes_count, newest->remove_data.count);
+                copy(removing, data, bytes_count);
+                newest->remove_data.count += bytes_count;
+                newest->remove_data.at = at;
+                merged = true;
+            }
+        }
+    }
+    remove_tokens_(at, bytes_count, merged ? null : &program.undo_buffer);
+    after_undoable_edit(removing, bytes_count);
+}
+
+// NOTE: push_delta may be null if you do not want to push to an undo/redo buffer
+void insert_tokens_(s24 at, u8 *tokens, u16 bytes_count, DeltaCollection* push_delta) {
+    require_full_index();
+    // NOTE: Making room in the window can resize appvars, so if tokens points into one,
+    // fit_program_window should have been called before getting the pointer. See paste_clipboard.
+    s24 linebreaks_to_add = 0;
+    for(s24 i = 0; i < bytes_count; i += get_token_size_from_first_byte(tokens[i])) {
+        if(tokens[i] == LINEBREAK) { linebreaks_to_add += 1; }
+    }
+    if(program.size + cast(s24)bytes_count <= PROGRAM_MAX_SIZE && fit_program_window(at, at, bytes_count) &&
+       reserve_linebreaks(linebreaks_to_add)) {
+        s24 line = calculate_line_y(at);
+        s24 line_end = get_line_end(line);
+
+        move_program_gap(at);
+        copy(tokens, program.data + program.gap_start, bytes_count);
+        program.gap_start += bytes_count;
+        program.size += bytes_count;
+        offset_linebreaks(at, bytes_count);
+        insert_labels(at, bytes_count);
+        
+        s24 add_linebreak_at;
+        if(linebreaks_to_add >= 1) {
+            add_linebreak_at = make_room_for_linebreaks(at, linebreaks_to_add);
+        }
+        for(s24 n = 0; n <= bytes_count - 1; n += get_token_size_from_first_byte(tokens[n])) {
+            if(tokens[n] == LINEBREAK) {
+                set_linebreak_location(add_linebreak_at, at + n);
+                get_linebreak(add_linebreak_at)->indentation = 0;
+                get_linebreak(add_linebreak_at)->width = LINE_WIDTH_UNKNOWN;
+                add_linebreak_at += 1;
+            }
+        }
+
+        if(linebreaks_to_add >= 1) {
+            // NOTE: The line got split, so the columns of everything after `at` changed
+            offset_line_checkpoints(at, bytes_count, at, 0);
+            drop_line_checkpoints(get_linebreak_location(line) + 1, get_line_end(line + linebreaks_to_add));
+            get_linebreak(line)->width = LINE_WIDTH_UNKNOWN;
+        } else {
+            s24 inserted_width = 0;
+            for(s24 i = at; i < at + bytes_count; i += get_token_size(i)) {
+                inserted_width += get_token_width(i);
+            }
+            offset_line_checkpoints(at, bytes_count, line_end, inserted_width);
+            if(get_linebreak(line)->width != LINE_WIDTH_UNKNOWN) {
+                s24 width = get_linebreak(line)->width + inserted_width;
+                get_linebreak(line)->width = (width < LINE_WIDTH_UNKNOWN) ? cast(u16)width : LINE_WIDTH_UNKNOWN;
+            }
+        }
+        
+        if(push_delta) {
+            push_insert_delta(push_delta, program.cursor, at, bytes_count);
+        }
+        note_program_edit(at, bytes_count);
+
+        s24 first_linebreak = calculate_line_y(at);
+        update_line_indentation(first_linebreak, first_linebreak + linebreaks_to_add);
+        mark_lines_dirty(first_linebreak, (linebreaks_to_add >= 1) ? LAST_LINE_POSSIBLE : first_linebreak);
+    } else if(program.size + cast(s24)bytes_count > PROGRAM_MAX_SIZE) {
+        program.notice = "The program would get too big";
+    } else {
+        // NOTE: Making room in the window or for the lines' blocks ran out
+        program.notice = "Not enough RAM";
+    }
+}
+
+void insert_tokens(s24 at, u8 *tokens, u16 tokens_count) {
+    Delta *newest = get_mergeable_undo_delta(tokens, tokens_count);
+    if(newest && newest->type == Delta_InsertTokens && newest->insert_data.at + newest->insert_data.count == at &&
+        newest->insert_data.count + tokens_count <= UNDO_MERGE_MAX_BYTES) {
+        s24 size_was = program.size;
+        insert_tokens_(at, tokens, tokens_count, null);
+        if(program.size != size_was) {
+            newest->insert_data.count += tokens_count;
+        }
+    } else {
+        insert_tokens_(at, tokens, tokens_count, &program.undo_buffer);
+    }
+    after_undoable_edit(tokens, tokens_count);
+}
+
+void insert_token_u8(s24 at, u8 token) {
+    insert_tokens(at, &token, 1);
+}
+void insert_token_u16(s24 at, u16 token) {
+    insert_tokens(at, cast(u8*)&token, 2);
+}
+
+// NOTE: Where replace_matches replaces is a list of gaps, each the number of bytes from the end of a match to the start
+// of the next one (from the start of the program for the first). Each takes 1 byte, or 3 if it's REPLACE_GAP_FAR or more.
+// The gaps are the same before and after the replacing, so undoing uses the same list.
+#define REPLACE_GAP_FAR 0xFF
+
+// NOTE: Returns how many bytes writing gap takes. Only writes it if gaps isn't null.
+u24 write_replace_gap(u8 *gaps, s24 gap) {
+    u24 result = 1;
+    if(gap >= REPLACE_GAP_FAR) {
+        result = 3;
+        if(gaps) {
+            gaps[0] = REPLACE_GAP_FAR;
+            gaps[1] = cast(u8)gap;
+            gaps[2] = cast(u8)(gap >> 8);
+        }
+    } else if(gaps) {
+        gaps[0] = cast(u8)gap;
+    }
+    return result;
+}
+
+s24 read_replace_gap(u8 **gaps) {
+    s24 result = (*gaps)[0];
+    *gaps += 1;
+    if(result == REPLACE_GAP_FAR) {
+        result = cast(s24)(*gaps)[0] | (cast(s24)(*gaps)[1] << 8);
+        *gaps += 2;
+    }
+    return result;
+}
+
+// NOTE: Drops the gaps after the first gaps_size bytes of them from the newest delta, a replace that stopped partway
+void trim_newest_replace_delta(DeltaCollection *collection, u16 gaps_size) {
+    Delta *delta = cast(Delta*)(collection->data + collection->newest);
+    assert(delta->type == Delta_ReplaceTokens && gaps_size <= delta->replace_data.gaps_size, "Not a replace to trim");
+    delta->replace_data.gaps_size = gaps_size;
+    collection->head = collection->newest + size_of_delta(delta);
+}
+
+// NOTE: Replaces the from_count bytes of `from` at the places the gaps say with the to_count bytes of `to`,
+// and indexes the program again after.
+// It goes a piece at a time, each piece as many matches as fit in the window at once (see fit_program_window):
+// the gap goes to the piece's first match, and the bytes up to its last match are copied down to it
+// with the replacements in place of the matches. Bytes after the piece stay where they are.
+// Returns how many bytes of the gaps it got through, 0 if it changed nothing. It only stops early when making room
+// in the window fails, and then the delta pushed into push_delta only has the matches that were replaced.
+// `to` must not point into program.data.
+u16 replace_matches(u8 *from, u8 from_count, u8 *to, u8 to_count, u8 *gaps, u16 gaps_size, DeltaCollection *push_delta) {
+    require_full_index();
+    u8 *gaps_end = gaps + gaps_size;
+    s24 matches_count = 0;
+    for(u8 *it = gaps; it < gaps_end; read_replace_gap(&it)) {
+        matches_count += 1;
+    }
+    s24 growth_per_match = cast(s24)to_count - cast(s24)from_count;
+    s24 linebreaks_growth = 0;
+    for(u8 i = 0; i < to_count; i += get_token_size_from_first_byte(to[i])) {
+        if(to[i] == LINEBREAK) { linebreaks_growth += matches_count; }
+    }
+    for(u8 i = 0; i < from_count; i += get_token_size_from_first_byte(from[i])) {
+        if(from[i] == LINEBREAK) { linebreaks_growth -= matches_count; }
+    }
+    bool may_replace = matches_count != 0 && program.size + matches_count*growth_per_match <= PROGRAM_MAX_SIZE &&
+                       reserve_linebreaks(max(0, linebreaks_growth));
+    if(may_replace && push_delta) {
+        push_replace_delta(push_delta, program.cursor, from, from_count, to, to_count, gaps, gaps_size);
+    }
+    u8 *it = gaps;
+    if(may_replace) {
+        // NOTE: Match positions are in the program as it was, shifted is how much the pieces before moved them
+        s24 shifted = 0;
+        s24 previous_end = 0;
+        s24 cursor = program.cursor;
+        s24 new_cursor = cursor;
+        s24 first_changed = -1;
+        s24 last_changed = 0;
+        while(it < gaps_end) {
+            // NOTE: Find where the piece ends before changing anything
+            u8 *piece_end = it;
+            s24 piece_first = previous_end + read_replace_gap(&piece_end);
+            s24 piece_end_at = piece_first + from_count;
+            s24 piece_growth = growth_per_match;
+            while(piece_end < gaps_end) {
+                u8 *next = piece_end;
+                s24 next_at = piece_end_at + read_replace_gap(&next);
+                if(next_at + from_count - piece_first > PROGRAM_MAX_EDIT_SIZE || piece_growth + growth_per_match > PROGRAM_MAX_EDIT_SIZE) {
+                    break;
+                }
+                piece_end = next;
+                piece_end_at = next_at + from_count;
+                piece_growth += growth_per_match;
+            }
+            if(!fit_program_window(piece_first + shifted, piece_end_at + shifted, max(0, piece_growth))) {
+                break;
+            }
+
+            // NOTE: Everything is written at or before where it's read from, since fit_program_window left room for the growth
+            move_program_gap(piece_first + shifted);
+            u8 *data = program.data;
+            s24 read = program.gap_end;
+            s24 write = program.gap_start;
+            bool first_in_piece = true;
+            while(it < piece_end) {
+                s24 gap = read_replace_gap(&it);
+                // NOTE: The piece's first gap is already before the program's gap
+                if(!first_in_piece) {
+                    copy_overlapping(data + read, data + write, gap);
+                    read += gap;
+                    write += gap;
+                }
+                first_in_piece = false;
+                assert(from_count == 0 || data[read] == from[0], "Replacing something else");
+                s24 match_at = previous_end + gap;
+                if(cursor >= match_at + from_count) {
+                    new_cursor += growth_per_match;
+                } else if(cursor > match_at) {
+                    new_cursor = program.window_start + write;
+                }
+                if(first_changed == -1) {
+                    first_changed = program.window_start + write;
+                }
+                copy(to, data + write, to_count);
+                read += from_count;
+                write += to_count;
+                previous_end = match_at + from_count;
+            }
+            program.gap_start = write;
+            program.gap_end = read;
+            program.size += piece_growth;
+            shifted += piece_growth;
+            last_changed = program.window_start + write;
+        }
+        u16 replaced = cast(u16)(it - gaps);
+        if(push_delta && replaced != gaps_size) {
+            if(replaced == 0) {
+                pop_delta(push_delta);
+            } else {
+                trim_newest_replace_delta(push_delta, replaced);
+            }
+        }
+        if(replaced != 0) {
+            program.cursor = new_cursor;
+            program.cursor_y_cache = 0;
+
+            // NOTE: Everything is found again like when loading
+            reset_linebreaks();
+            program.line_checkpoints_count = 0;
+            program.labels_count = 0;
+            program.labels_overflowed = false;
+            program.labels_by_name_dirty = true;
+            program.indexed_until = 0;
+            program.fully_indexed = false;
+            index_program(PROGRAM_MAX_SIZE);
+            trim_free_line_blocks();
+
+            note_program_edit(first_changed, last_changed - first_changed);
+            mark_lines_dirty(0, LAST_LINE_POSSIBLE);
+        }
+    }
+    return cast(u16)(it - gaps);
+}
+
+// It's intended to use this with an undo_delta, then pass the redo_buffer into put_undo_for_this_action_into_collection
+// and the same for using redo_deltas and passing undo_buffers, so it's all reversible.
+void apply_delta_to_program(Delta *delta, DeltaCollection *put_undo_for_this_action_into_collection) {
+    assert(put_undo_for_this_action_into_collection != null, "Must be non-null");
+    if(delta->type == Delta_InsertTokens) {
+        remove_tokens_(delta->insert_data.at, delta->insert_data.count, put_undo_for_this_action_into_collection);
+    }
+    if(delta->type == Delta_RemoveTokens) {
+        // NOTE: Data is stored after *delta structure pointer
+        u8 *data = (cast(u8*)delta) + sizeof(Delta);
+        insert_tokens_(delta->remove_data.at, data, delta->remove_data.count, put_undo_for_this_action_into_collection);
+    }
+    if(delta->type == Delta_ReplaceTokens) {
+        u8 *data = (cast(u8*)delta) + sizeof(Delta);
+        u8 *from = data;
+        u8 *to = from + delta->replace_data.from_count;
+        u8 *gaps = to + delta->replace_data.to_count;
+        replace_matches(to, delta->replace_data.to_count, from, delta->replace_data.from_count, gaps, delta->replace_data.gaps_size,
+                        put_undo_for_this_action_into_collection);
+    }
+    program.cursor = delta->cursor_was;
+}
+
+inline bool get_is_prgm_exec_override() {
+    return program.opened_directory == &directories[DIR_PRGM] && program.opened_directory_list_index == 3;
+}
+
+inline bool get_is_list_name_override() {
+    return program.opened_directory == &directories[DIR_LIST] && program.opened_directory_list_index == 0;
+}
+
+// NOTE: Looks at up to max_bytes more of the program for linebreaks. See indexed_until.
+void index_program(s24 max_bytes) {
+    s24 end = min(program.size, program.indexed_until + max_bytes);
+    // NOTE: The last line so far may go on in this slice
+    s24 first_changed_line = program.linebreaks_count - 1;
+    s24 i = program.indexed_until;
+    while(i < end) {
+        u8 byte = get_program_byte(i);
+        if(byte == LBL) {
+            add_label(program.labels_count, i);
+        }
+        if(byte == LINEBREAK) {
+            if(!reserve_linebreaks(1)) {
+                // NOTE: Only the heap limits how many lines there can be, see LINE_BLOCK_HEAP_BYTES
+                exit_with_message("Not enough RAM for this many lines.");
+                i = program.size;
+                break;
+            } else {
+                s24 line = make_room_for_linebreaks(i, 1);
+                set_linebreak_location(line, i);
+                get_linebreak(line)->indentation = 0;
+                get_linebreak(line)->width = LINE_WIDTH_UNKNOWN;
+            }
+        }
+        i += get_token_size(i);
+    }
+    program.indexed_until = i;
+    update_line_indentation(first_changed_line, program.linebreaks_count - 1);
+    if(i >= program.size) {
+        program.fully_indexed = true;
+    }
+}
+
+void require_full_index(void) {
+    if(!program.fully_indexed) {
+        index_program(PROGRAM_MAX_SIZE);
+    }
+}
+
+// NOTE: Indexes until line and the screen after it are whole lines
+void index_program_through_line(s24 line) {
+    while(!program.fully_indexed && program.linebreaks_count - 1 <= line + EDITOR_ROW_COUNT) {
+        index_program(PROGRAM_INDEX_SLICE_BYTES);
+    }
+}
+
+void keep_program_indexed_around_cursor(void) {
+    if(program.program_loaded && !program.fully_indexed) {
+        while(!program.fully_indexed && program.indexed_until <= program.cursor) {
+            index_program(PROGRAM_INDEX_SLICE_BYTES);
+        }
+        index_program_through_line(calculate_cursor_y());
     }
 }
 
-s24 calculate_line_y(s24 token_offset) {
-    s24 result = program.linebreaks_count - 1;
-    for(int i = 0; i <= program.linebreaks_count - 1; ++i) {
-        if(token_offset <= get_linebreak_location(i)) {
-            result = i - 1;
+// NOTE: The (up to) two letters or digits after the Lbl token, one byte each, as goto takes them
+u16 get_label_name(s24 label_at) {
+    u16 result = 0;
+    for(s24 i = label_at + 1; i <= min(label_at + 2, program.size - 1); ++i) {
+        u8 byte = get_program_byte(i);
+        if((byte >= '0' && byte <= '9') || (byte >= 'A' && byte <= 'Z')) {
+            result = cast(u16)((result << 8) | byte);
+        } else {
             break;
         }
     }
     return result;
 }
 
-s24 calculate_cursor_y(void) {
-    return calculate_line_y(program.cursor);
+bool label_sorts_before(u16 a, u16 b) {
+    u16 name_a = get_label_name(program.labels[a]);
+    u16 name_b = get_label_name(program.labels[b]);
+    return name_a < name_b || (name_a == name_b && a < b);
 }
 
-// NOTE: When a line changes, only future lines get affected.
-// So line+1 is what is marked as dirty
-void mark_indentation_dirty_from_line_changed(s24 line_that_changed) {
-    assert(program.linebreaks_dirty_indentation_min != 0, "Should never be 0");
-    assert(line_that_changed >= 0 && line_that_changed <= 65536, "valid u16 range");
-    program.linebreaks_dirty_indentation_min = min(program.linebreaks_dirty_indentation_min, cast(u16)line_that_changed + 1);
+void sift_down_label(s24 root, s24 count) {
+    u16 *order = program.labels_by_name;
+    while(root*2 + 1 <= count - 1) {
+        s24 child = root*2 + 1;
+        if(child + 1 <= count - 1 && label_sorts_before(order[child], order[child + 1])) {
+            child += 1;
+        }
+        if(!label_sorts_before(order[root], order[child])) {
+            break;
+        }
+        u16 swap = order[root];
+        order[root] = order[child];
+        order[child] = swap;
+        root = child;
+    }
 }
 
-// NOTE: push_delta may be null if you do not want to push to an undo/redo buffer
-void remove_tokens_(s24 at, u16 bytes_count, DeltaCollection* push_delta) {
-    if(push_delta) {
-        push_remove_delta(push_delta, program.cursor, at, program.data + at, bytes_count);
+// NOTE: Heapsort, so it needs no memory besides labels_by_name
+void sort_labels_by_name(void) {
+    u16 *order = program.labels_by_name;
+    s24 count = program.labels_count;
+    for(s24 i = 0; i <= count - 1; ++i) {
+        order[i] = cast(u16)i;
     }
-
-    if(at < 0) {
-        bytes_count += at;
-        at = 0;
+    for(s24 root = count/2 - 1; root >= 0; --root) {
+        sift_down_label(root, count);
     }
+    for(s24 end = count - 1; end >= 1; --end) {
+        u16 swap = order[0];
+        order[0] = order[end];
+        order[end] = swap;
+        sift_down_label(0, end);
+    }
+    program.labels_by_name_dirty = false;
+}
 
-    if(at <= program.size - 1) {
-        s24 max = at + bytes_count - 1;
-        if(max >= program.size) {
-            max = program.size - 1;
-            s24 new_count = ((max - at) + 1);
-            assert(new_count >= 0 && new_count <= 65536, "Must be within u16 range");
-            bytes_count = cast(u16)new_count;
+// NOTE: Returns the offset of the first label with this name, -1 if there isn't one
+s24 find_label_named(u16 name) {
+    require_full_index();
+    s24 result = -1;
+    if(program.labels_overflowed) {
+        for(s24 i = 0; i <= program.size - 1; i += get_token_size(i)) {
+            if(get_program_byte(i) == LBL && get_label_name(i) == name) {
+                result = i;
+                break;
+            }
         }
-        if(bytes_count != 0) {
-            s24 linebreaks_count = 0;
-            for(s24 i = at; i <= at + (bytes_count - 1); ++i) {
-                if(program.data[i] == LINEBREAK) {
-                    linebreaks_count += 1;
-                }
+    } else {
+        if(program.labels_by_name_dirty) {
+            sort_labels_by_name();
+        }
+        s24 low = 0;
+        s24 high = program.labels_count;
+        while(low < high) {
+            s24 mid = (low + high) / 2;
+            if(get_label_name(program.labels[program.labels_by_name[mid]]) < name) {
+                low = mid + 1;
+            } else {
+                high = mid;
             }
-            s24 first_linebreak = calculate_line_y(at) + 1;
-
-            if(linebreaks_count >= 1) {
-                for(s24 i = first_linebreak; i <= program.linebreaks_count - linebreaks_count - 1; ++i) {
-                    program.linebreaks[i] = program.linebreaks[i + linebreaks_count];
-                }
-                program.linebreaks_count -= linebreaks_count;
-            }
-
-            {
-                // NOTE: Unrolled version of the loop
-                // for(s24 i = at; i <= program.size - (bytes_count - 1); ++i) {
-                //     program.data[i] = program.data[i + bytes_count];
-                // }
-                s24 min = at;
-                s24 max = program.size - (bytes_count - 1);
-                s24 iterate_count = (max+1)-min;
-                s24 iterate_count_by_4 = iterate_count/4;
-                s24 iterate_count_remainder = iterate_count - (4*iterate_count_by_4);
-                s24 it = min;
-                while(iterate_count_by_4 >= 1) {
-                    program.data[it+0] = program.data[it + 0 + bytes_count];
-                    program.data[it+1] = program.data[it + 1 + bytes_count];
-                    program.data[it+2] = program.data[it + 2 + bytes_count];
-                    program.data[it+3] = program.data[it + 3 + bytes_count];
-                    it += 4;
-                    iterate_count_by_4 -= 1;
-                }
-                while(iterate_count_remainder >= 1) {
-                    program.data[it] = program.data[it + bytes_count];
-                    it += 1;
-                    iterate_count_remainder -= 1;
-                }
+        }
+        if(low <= program.labels_count - 1) {
+            s24 label_at = program.labels[program.labels_by_name[low]];
+            if(get_label_name(label_at) == name) {
+                result = label_at;
             }
-            offset_linebreaks(at, -1 * cast(s24)bytes_count);
-            program.size -= bytes_count;
-
-            mark_indentation_dirty_from_line_changed(first_linebreak - 1);
         }
-
     }
+    return result;
 }
 
-void remove_tokens(s24 at, u16 bytes_count) {
-    remove_tokens_(at, bytes_count, &program.undo_buffer);
-    clear_delta_collection(&program.redo_buffer);
+// NOTE: Puts the cursor on the label and the label in the middle of the screen. Returns the cursor's line.
+s24 go_to_label(s24 label_at) {
+    program.cursor = label_at;
+    s24 cursor_y = calculate_cursor_y();
+    program.view_top_line = max(0, cursor_y - 11);
+    return cursor_y;
 }
 
-// NOTE: push_delta may be null if you do not want to push to an undo/redo buffer
-void insert_tokens_(s24 at, u8 *tokens, u16 bytes_count, DeltaCollection* push_delta) {
-    if(program.size + cast(s24)bytes_count < PROGRAM_DATA_SIZE) {
-        program.size += bytes_count;
-        offset_linebreaks(at, bytes_count);
-        make_room_for_tokens(at, bytes_count);
-        
-        s24 linebreaks_to_add = 0;
-        for(s24 i = 0; i < bytes_count; ++i) {
-            if(tokens[i] == LINEBREAK) { linebreaks_to_add += 1; }
-        }
-        s24 add_linebreak_at;
-        if(linebreaks_to_add >= 1) {
-            add_linebreak_at = make_room_for_linebreaks(at, linebreaks_to_add);
-        }
-        s24 n = 0;
-        for(s24 i = at; i <= at + bytes_count - 1; ++i, ++n) {
-            program.data[i] = tokens[n];
-            if(tokens[n] == LINEBREAK) {
-                program.linebreaks[add_linebreak_at].location_ = cast(u16)i;
-                add_linebreak_at += 1;
-            }
-        }
-        
-        if(push_delta) {
-            push_insert_delta(push_delta, program.cursor, at, bytes_count);
-        }
+void open_label_browser(void) {
+    require_full_index();
+    program.browsing_labels = true;
+    // NOTE: Starts on the last label at or before the cursor
+    program.label_browser_index = max(0, find_label(program.cursor + 1) - 1);
+    program.label_browser_view_top = 0;
+}
 
-        s24 first_linebreak = calculate_line_y(at);
-        mark_indentation_dirty_from_line_changed(first_linebreak);
-    } else {
-        assert(false, "Program too large");
+// NOTE: The closest place at or before pos that we know a token starts at,
+// which is the start of its line or a line checkpoint. Walking from there takes at most
+// LINE_CHECKPOINT_SPACING tokens on lines that have checkpoints. If it's further back than that,
+// the line's checkpoints are missing or out of date, so they're indexed first.
+s24 get_known_token_start(s24 pos) {
+    s24 line = calculate_line_y(pos);
+    s24 line_start = get_linebreak_location(line) + 1;
+    s24 checkpoint = find_line_checkpoint(pos);
+    s24 result = (checkpoint >= 0) ? max(line_start, cast(s24)program.line_checkpoints[checkpoint].offset) : line_start;
+    // NOTE: Tokens are at most 2 bytes, so this many bytes is more than 2*LINE_CHECKPOINT_SPACING tokens
+    if(pos - result > 4*LINE_CHECKPOINT_SPACING) {
+        index_line_checkpoints(line);
+        checkpoint = find_line_checkpoint(pos);
+        result = (checkpoint >= 0) ? max(line_start, cast(s24)program.line_checkpoints[checkpoint].offset) : line_start;
     }
+    return result;
 }
 
-void insert_tokens(s24 at, u8 *tokens, u16 tokens_count) {
-    insert_tokens_(at, tokens, tokens_count, &program.undo_buffer);
-    clear_delta_collection(&program.redo_buffer);
+bool is_token_start(s24 pos) {
+    s24 i = get_known_token_start(pos);
+    while(i < pos) {
+        i += get_token_size(i);
+    }
+    return i == pos;
 }
 
-void insert_token_u8(s24 at, u8 token) {
-    insert_tokens(at, &token, 1);
+// NOTE: Where the token before the one at pos starts. The byte before pos can be the second byte
+// of a token that looks like a prefix, so this walks from a known token start instead of guessing.
+s24 get_previous_token_start(s24 pos) {
+    s24 result = get_known_token_start(pos - 1);
+    for(s24 i = result; i < pos; i += get_token_size(i)) {
+        result = i;
+    }
+    return result;
 }
-void insert_token_u16(s24 at, u16 token) {
-    insert_tokens(at, cast(u8*)&token, 2);
+
+// NOTE: Only compares bytes, so `at` must be a token start for it to be a match
+bool search_matches_at(s24 at) {
+    bool result = program.search_size != 0 && at + program.search_size <= program.size;
+    for(s24 i = 0; result && i <= program.search_size - 1; ++i) {
+        result = get_program_byte(at + i) == program.search_tokens[i];
+    }
+    return result;
 }
 
-// It's intended to use this with an undo_delta, then pass the redo_buffer into put_undo_for_this_action_into_collection
-// and the same for using redo_deltas and passing undo_buffers, so it's all reversible.
-void apply_delta_to_program(Delta *delta, DeltaCollection *put_undo_for_this_action_into_collection) {
-    assert(put_undo_for_this_action_into_collection != null, "Must be non-null");
-    if(delta->type == Delta_InsertTokens) {
-        remove_tokens_(delta->insert_data.at, delta->insert_data.count, put_undo_for_this_action_into_collection);
+// NOTE: Horspool. The byte under the last byte of the pattern says how far the pattern can move
+// before that byte could be part of a match, so most bytes of the program are never looked at.
+// Returns the first match that starts between first and last, -1 if there isn't one.
+s24 search_forward(s24 first, s24 last) {
+    s24 result = -1;
+    s24 size = program.search_size;
+    u8 *tokens = program.search_tokens;
+    u8 skip[256];
+    for(u24 byte = 0; byte <= 255; ++byte) {
+        skip[byte] = cast(u8)size;
     }
-    if(delta->type == Delta_RemoveTokens) {
-        // NOTE: Data is stored after *delta structure pointer
-        u8 *data = (cast(u8*)delta) + sizeof(Delta);
-        insert_tokens_(delta->remove_data.at, data, delta->remove_data.count, put_undo_for_this_action_into_collection);
+    for(s24 i = 0; i <= size - 2; ++i) {
+        skip[tokens[i]] = cast(u8)(size - 1 - i);
     }
-    program.cursor = delta->cursor_was;
+    last = min(last, program.size - size);
+    for(s24 at = first; at <= last;) {
+        u8 byte = get_program_byte(at + size - 1);
+        if(byte == tokens[size - 1] && search_matches_at(at) && is_token_start(at)) {
+            result = at;
+            break;
+        }
+        at += skip[byte];
+    }
+    return result;
 }
 
-inline bool get_is_prgm_exec_override() {
-    return program.opened_directory == &directories[DIR_PRGM] && program.opened_directory_list_index == 3;
+// NOTE: Like search_forward, but it goes from last to first and skips by the byte under the first byte of the pattern.
+// Returns the last match that starts between first and last, -1 if there isn't one.
+s24 search_backward(s24 first, s24 last) {
+    s24 result = -1;
+    s24 size = program.search_size;
+    u8 *tokens = program.search_tokens;
+    u8 skip[256];
+    for(u24 byte = 0; byte <= 255; ++byte) {
+        skip[byte] = cast(u8)size;
+    }
+    for(s24 i = size - 1; i >= 1; --i) {
+        skip[tokens[i]] = cast(u8)i;
+    }
+    last = min(last, program.size - size);
+    for(s24 at = last; at >= first;) {
+        u8 byte = get_program_byte(at);
+        if(byte == tokens[0] && search_matches_at(at) && is_token_start(at)) {
+            result = at;
+            break;
+        }
+        at -= skip[byte];
+    }
+    return result;
 }
 
-inline bool get_is_list_name_override() {
-    return program.opened_directory == &directories[DIR_LIST] && program.opened_directory_list_index == 0;
+// NOTE: Stops before the first linebreak, so a match is always on one line and editing a line
+// can only change the matches on it
+void set_search_tokens(s24 at, s24 size) {
+    program.search_size = 0;
+    for(s24 i = at; i < at + min(size, SEARCH_MAX_BYTES) && get_program_byte(i) != LINEBREAK;) {
+        u8 token_size = get_token_size(i);
+        if(i + token_size > at + min(size, SEARCH_MAX_BYTES)) {
+            break;
+        }
+        i += token_size;
+        program.search_size = i - at;
+    }
+    for(s24 i = 0; i <= program.search_size - 1; ++i) {
+        program.search_tokens[i] = get_program_byte(at + i);
+    }
+    mark_lines_dirty(0, LAST_LINE_POSSIBLE);
+}
+
+void clear_search_tokens(void) {
+    program.search_size = 0;
+    mark_lines_dirty(0, LAST_LINE_POSSIBLE);
+}
+
+// NOTE: 2nd+Up/Down. Searches for the selection if there is one, else for what was searched last,
+// else for the token under the cursor, and puts the cursor on the next match, wrapping around the program.
+void search_from_cursor(bool backwards) {
+    require_full_index();
+    if(program.cursor_selecting) {
+        Range range = get_selecting_range();
+        set_search_tokens(range.min, min(range.max + 1, program.size) - range.min);
+        program.cursor_selecting = false;
+        program.cursor = range.min;
+    } else if(program.search_size == 0 && program.cursor <= program.size - 1) {
+        set_search_tokens(program.cursor, get_token_size(program.cursor));
+    }
+    if(program.search_size != 0) {
+#if DEBUG
+        u24 search_started_clock = cast(u24)clock();
+#endif
+        s24 found;
+        if(backwards) {
+            found = search_backward(0, program.cursor - 1);
+            if(found == -1) { found = search_backward(program.cursor, program.size); }
+        } else {
+            found = search_forward(program.cursor + 1, program.size);
+            if(found == -1) { found = search_forward(0, program.cursor); }
+        }
+#if DEBUG
+        u24 search_ms = ((cast(u24)clock() - search_started_clock) * 1000) / cast(u24)CLOCKS_PER_SEC;
+        log("Search took %dms for %d bytes in %d bytes\n", search_ms, program.search_size, program.size);
+#endif
+        if(found != -1) {
+            program.cursor = found;
+        }
+    }
+}
+
+// NOTE: 2nd+Enter. Replaces every match of the search with what's on the clipboard, as one edit with one undo delta.
+void replace_all_matches(void) {
+    require_full_index();
+    u8 to[SEARCH_MAX_BYTES];
+    s24 to_count = -1;
+    u8 handle = ti_Open(CLIPBOARD_APPVAR_NAME, "r");
+    if(handle) {
+        s24 size = cast(s24)ti_GetSize(handle);
+        if(size <= SEARCH_MAX_BYTES && cast(s24)ti_Read(to, 1, cast(size_t)size, handle) == size) {
+            to_count = size;
+        }
+        ti_Close(handle);
+    }
+    if(program.search_size != 0 && to_count >= 0) {
+#if DEBUG
+        u24 replace_started_clock = cast(u24)clock();
+#endif
+        u24 gaps_size = 0;
+        s24 matches_count = 0;
+        s24 end = 0;
+        for(s24 at = search_forward(0, program.size); at != -1; at = search_forward(end, program.size)) {
+            gaps_size += write_replace_gap(null, at - end);
+            matches_count += 1;
+            end = at + program.search_size;
+        }
+        // NOTE: Nothing gets replaced without its undo delta, and the gaps have to fit in the undo buffer
+        Delta *placed_at = null;
+        if(program.size + matches_count*(to_count - program.search_size) > PROGRAM_MAX_SIZE) {
+            program.notice = "The program would get too big";
+        } else if(gaps_size != 0 && sizeof(Delta) + cast(u24)program.search_size + cast(u24)to_count + gaps_size <=
+                                      ARRLEN(program.undo_buffer.data)) {
+            // NOTE: The gaps are written straight into the undo delta, and replace_matches reads them from there.
+            // A delta too big for the undo buffer would throw away the undo history, so that's checked first.
+            placed_at = push_replace_delta(&program.undo_buffer, program.cursor, program.search_tokens, cast(u8)program.search_size,
+                                           to, cast(u8)to_count, null, cast(u16)gaps_size);
+            if(!placed_at) {
+                program.notice = "Too many matches to undo";
+            }
+        } else if(gaps_size != 0) {
+            program.notice = "Too many matches to undo";
+        }
+        if(placed_at) {
+            u8 *from = (cast(u8*)placed_at) + sizeof(Delta);
+            u8 *gaps = from + program.search_size + to_count;
+            u8 *it = gaps;
+            end = 0;
+            for(s24 at = search_forward(0, program.size); at != -1; at = search_forward(end, program.size)) {
+                it += write_replace_gap(it, at - end);
+                end = at + program.search_size;
+            }
+            u16 replaced = replace_matches(from, cast(u8)program.search_size, to, cast(u8)to_count, gaps, cast(u16)gaps_size, null);
+            if(replaced == 0) {
+                pop_delta(&program.undo_buffer);
+                program.notice = "Not enough RAM to replace";
+            } else {
+                if(replaced != gaps_size) {
+                    trim_newest_replace_delta(&program.undo_buffer, replaced);
+                    program.notice = "Not enough RAM to replace all";
+                }
+                after_undoable_edit(null, 0);
+            }
+        }
+#if DEBUG
+        u24 replace_ms = ((cast(u24)clock() - replace_started_clock) * 1000) / cast(u24)CLOCKS_PER_SEC;
+        log("Replace all took %dms for %d bytes of gaps in %d bytes\n", replace_ms, gaps_size, program.size);
+#endif
+    }
 }
 
 // NOTE: This ZEROES the global "static LoadedProgram program = {}" state!
 void load_program(char *name) {
+    u24 started_clock = cast(u24)clock();
+    close_program_window();
+    release_linebreaks();
     zero(&program, sizeof(LoadedProgram));
-    program.linebreaks[0].location_ = 0;
-    program.linebreaks_count = 1;
+#if SINGLE_BUFFERED
+    program.data = PROGRAM_STORE;
+#endif
+    program.data[PROGRAM_DATA_SIZE] = 0;
+    program.gap_start = 0;
+    program.gap_end = PROGRAM_DATA_SIZE;
+    program.cold_page_start = -1;
+    if(!reset_linebreaks()) {
+        exit_with_message("Not enough RAM to load the program.");
+    }
 
     int n;
     for(n = 0; n <= 8 - 1; ++n) {
@@ -1257,37 +3798,47 @@ void load_program(char *name) {
             program.archived = false;
         }
         u24 size = cast(u24)ti_GetSize(load);
-        assert(size <= PROGRAM_DATA_SIZE, "Program too big");
+        assert(size <= PROGRAM_MAX_SIZE, "Program too big");
         assert(size <= 65536, "program.size is u16");
-        if(size <= PROGRAM_DATA_SIZE) {
-            u24 amount_read = ti_Read(program.data, 1, size, load);
-            bool success = (size == amount_read);
-            assert(success, "Failed to read. %d != %d", size, amount_read);
-            if(success) {
-                program.size = cast(u16)size;
-                s24 indentation = 0;
-                for(u16 i = 0; i <= program.size - 1;) {
-                    u8 byte = program.data[i];
-                    change_indentation_based_on_byte(indentation, byte);
-                    if(byte == LINEBREAK) {
-                        if(program.linebreaks_count == ARRLEN(program.linebreaks) - 1) {
-                            assert(cast(u24)program.linebreaks_count < ARRLEN(program.linebreaks) - 1, "Too big");
-                            exit_with_message("Program has too many line breaks!");
-                            break;
-                        } else {
-                            program.linebreaks_count += 1;
-                            program.linebreaks[program.linebreaks_count - 1].location_ = i;
-                            program.linebreaks[program.linebreaks_count - 1].indentation = cast(u8)indentation;
-                        }
+        if(size <= PROGRAM_MAX_SIZE) {
+            // NOTE: If it doesn't fit, the start goes in the window and the rest in the window appvar
+            u24 in_window = size;
+            if(size > PROGRAM_DATA_SIZE) {
+                in_window = PROGRAM_DATA_SIZE - PROGRAM_WINDOW_MIN_GAP;
+            }
+            u24 amount_read = ti_Read(program.data, 1, in_window, load);
+            bool success = (in_window == amount_read);
+            program.loaded_checksum = update_checksum(0, program.data, amount_read);
+            if(success && in_window < size) {
+                u8 cold = ti_Open(PROGRAM_WINDOW_APPVAR_NAME, "w");
+                success = cold != 0;
+                if(cold) {
+                    program.windowed = true;
+                    // NOTE: Goes through the gap
+                    u8 *buffer = program.data + in_window;
+                    for(u24 copied = in_window; success && copied < size; copied += PROGRAM_WINDOW_MIN_GAP) {
+                        u24 count = min(size - copied, PROGRAM_WINDOW_MIN_GAP);
+                        success = ti_Read(buffer, 1, count, load) == count && ti_Write(buffer, 1, count, cold) == count;
+                        program.loaded_checksum = update_checksum(program.loaded_checksum, buffer, count);
                     }
-                    i += get_token_size(i);
+                    ti_Close(cold);
+                    program.cold_after = cast(s24)(size - in_window);
                 }
+            }
+            assert(success, "Failed to read. %d != %d", in_window, amount_read);
+            if(success) {
+                program.size = cast(u16)size;
+                // NOTE: The program was read into the front of the array, so the gap is everything after it
+                program.gap_start = cast(s24)in_window;
+                program.gap_end = PROGRAM_DATA_SIZE;
+                // NOTE: Just the first screen, the main loop does the rest
+                index_program_through_line(0);
                 fully_loaded_program = true;
             } else {
                 exit_with_message("Failed to read program.");
             }
         } else {
-            exit_with_message("Program too big. (Max 42500 bytes)");
+            exit_with_message("Program too big. (Max 65505 bytes)");
         }
         ti_Close(load);
     } else {
@@ -1295,72 +3846,444 @@ void load_program(char *name) {
         editor.running = false;
     }
 
-    if(fully_loaded_program) {
-        program.program_loaded = true;
-        program.linebreaks_dirty_indentation_min = 1;
-        // NOTE: Save right now so we can see if the program is too big
-        // and we're unable to save, so we can trigger a "Not enough ram to save" error immediately
-        save_program(false);
+    if(fully_loaded_program) {
+        program.program_loaded = true;
+        open_undo_journal();
+        mark_program_saved();
+        // NOTE: Saving an archived program makes a copy in RAM, so do it right now to see if there's room,
+        // so we can trigger a "Not enough ram to save" error immediately
+        program.save_needs_full_write = program.archived;
+        save_program();
+    }
+    end_profile_phase(ProfilePhase_Load, started_clock);
+}
+
+// NOTE: The variable is in RAM and held the program as it was at saved_generation. This brings it a step
+// closer to the program: if the size changed, it's resized and the unchanged suffix is moved to where it is now,
+// then up to max_bytes after the unchanged prefix are written and the prefix grows by that much.
+// Edits between slices are fine, note_program_edit narrows the unchanged parts like it would after a save.
+// Returns true when there's nothing left to do, either because it's saved or because it failed
+// (and save_needs_full_write is set).
+bool save_program_slice(s24 max_bytes) {
+    bool finished = true;
+    bool success = false;
+    u8 handle = ti_OpenVar(cast(char*)program.program_name, "r+", OS_TYPE_PRGM);
+    if(handle) {
+        s24 old_size = cast(s24)ti_GetSize(handle);
+        s24 prefix = program.unchanged_prefix;
+        s24 suffix = program.unchanged_suffix;
+        assert(prefix + suffix <= old_size && prefix + suffix <= program.size, "Unchanged parts overlap");
+        success = true;
+        if(program.size > old_size) {
+            void *unused;
+            u24 free_ram = os_MemChk(&unused);
+            if(cast(s24)free_ram >= program.size - old_size) {
+                success = ti_Resize(cast(size_t)program.size, handle) == program.size;
+            } else {
+                // TODO: Same as in save_program
+                assert(false, "Not enough room to grow the program");
+                exit_with_message("Not enough RAM to save");
+                success = false;
+            }
+        }
+        if(success && program.size != old_size && suffix > 0) {
+            // NOTE: The data pointer is good until the next time a variable changes size
+            ti_Seek(0, SEEK_SET, handle);
+            u8 *saved = cast(u8*)ti_GetDataPtr(handle);
+            copy_overlapping(saved + old_size - suffix, saved + program.size - suffix, suffix);
+        }
+        if(success && program.size < old_size) {
+            success = ti_Resize(cast(size_t)program.size, handle) == program.size;
+        }
+        if(success) {
+            s24 count = min(max_bytes, program.size - suffix - prefix);
+            if(count > 0) {
+                ti_Seek(prefix, SEEK_SET, handle);
+                success = write_program_range(handle, prefix, count);
+                program.unchanged_prefix = prefix + count;
+            }
+            finished = program.unchanged_prefix >= program.size - suffix;
+        }
+        ti_Close(handle);
+    }
+    if(!success) {
+        // NOTE: Who knows what the variable holds now
+        program.save_needs_full_write = true;
+    } else if(finished) {
+        mark_program_saved();
+    }
+    return finished;
+}
+
+void mark_program_saved(void) {
+    program.saved_generation = program.edit_generation;
+    program.unchanged_prefix = program.size;
+    program.unchanged_suffix = program.size;
+    program.save_needs_full_write = false;
+    for(s24 i = 0; i <= os_programs_count - 1; ++i) {
+        if(strncmp(cast(char*)os_programs[i].name, cast(char*)program.program_name, sizeof(os_programs[i].name)) == 0) {
+            if(os_programs[i].size != program.size || os_programs[i].archived != program.archived) {
+                os_programs[i].size = cast(u16)program.size;
+                os_programs[i].archived = program.archived;
+                catalog_changed = true;
+            }
+            break;
+        }
+    }
+}
+
+void save_program(void) {
+    u24 started_clock = cast(u24)clock();
+    assert(program.program_loaded, "Program should be loaded");
+    bool changed = program.saved_generation != program.edit_generation || program.save_needs_full_write;
+    if(program.program_loaded && changed) {
+        u8 handle = ti_OpenVar((char*)program.program_name, "r", OS_TYPE_PRGM);
+        u16 space_that_will_be_freed = 0;
+        bool patch = false;
+        if(handle) {
+            if(!ti_IsArchived(handle)) {
+                space_that_will_be_freed = ti_GetSize(handle);
+                patch = !program.save_needs_full_write;
+            }
+            ti_Close(handle);
+        }
+        if(patch) {
+            save_program_slice(PROGRAM_MAX_SIZE);
+        } else {
+            void *unused;
+            u24 free_ram = os_MemChk(&unused);
+            bool has_room = cast(s24)free_ram >= (cast(s24)program.size - cast(s24)space_that_will_be_freed);
+            if(has_room) {
+                // ti_DeleteVar(cast(char*)program.program_name, OS_TYPE_PRGM);
+                handle = ti_OpenVar(cast(char*)program.program_name, "w", OS_TYPE_PRGM);
+                bool written = write_program_range(handle, 0, program.size);
+                assert(written, "Didn't write full program... %d", program.size);
+                if(written) {
+                    mark_program_saved();
+                }
+                ti_Close(handle);
+            } else {
+                // TODO: We probably want to open a "go archive some programs" wizard
+                // so the user can still manage to save instead of losing their data...
+                // The good thing is autosave will make this not so bad
+                assert(false, "Not enough room to write appvar");
+                exit_with_message("Not enough RAM to save");
+            }
+        }
+    }
+    program.autosaving = false;
+    end_profile_phase(ProfilePhase_Save, started_clock);
+}
+
+// NOTE: The final archiving of the variable when we exit, after program.data_released. See archive_variable.
+void archive_program_if_it_was(void) {
+    if(program.archived) {
+        u8 handle = ti_OpenVar(cast(char*)program.program_name, "r", OS_TYPE_PRGM);
+        if(handle) {
+            ti_SetArchiveStatus(true, handle);
+            ti_Close(handle);
+        }
+    }
+}
+
+void open_directory(u8 index) {
+    program.opened_directory = &directories[index];
+    program.opened_directory_list_index = 0;
+    program.opened_directory_token_index = 0;
+}
+
+bool save_clipboard(s24 at, s24 size) {
+    assert(size >= 0 && size <= PROGRAM_MAX_SIZE, "Too big clipboard save");
+    bool success = false;
+    u8 clipboard_handle = ti_Open(CLIPBOARD_APPVAR_NAME, "w");
+    if(clipboard_handle) {
+        if(write_program_range(clipboard_handle, at, size)) {
+            success = true;
+            archive_variable(clipboard_handle);
+        }
+        ti_Close(clipboard_handle);
+        if(!success) { ti_Delete(CLIPBOARD_APPVAR_NAME); }
+    }
+    return success;
+}
+
+// NOTE: The undo journal is an appvar that undo_buffer spills its oldest deltas into, so undo history isn't
+// limited by DELTA_COLLECTION_SIZE. It's a stack: a header, then each delta followed by its size as a u16,
+// oldest first. When undo runs out of deltas in RAM, the newest ones on the journal are paged back in.
+// On exit, what's left in undo_buffer goes on the journal too and it's kept for next time the same program is opened.
+// Every program has its own journal, named UNDO_JOURNAL_APPVAR_PREFIX and 3 characters from a hash of its name,
+// so opening another program leaves it alone. If two names hash the same, each starts the other's journal over,
+// like it would if the program had been changed.
+#define UNDO_JOURNAL_VERSION 0
+#define UNDO_JOURNAL_MAX_SIZE 49152
+// NOTE: Set to 0 to delete the journal on exit instead
+#define KEEP_UNDO_JOURNAL_BETWEEN_SESSIONS 1
+
+typedef struct UndoJournalHeader {
+    u8 version;
+    u8 program_name[9];
+    // NOTE: What the program looked like when the journal was closed, so we only reuse it if it wasn't changed since
+    u16 program_size;
+    u16 program_checksum;
+    u24 delta_count;
+} UndoJournalHeader;
+
+// NOTE: Fletcher-16, carried on from `checksum` over `count` more bytes. Start from 0.
+u16 update_checksum(u16 checksum, u8 *bytes, u24 count) {
+    u16 a = checksum & 0xFF;
+    u16 b = checksum >> 8;
+    for(u24 i = 0; i < count; ++i) {
+        a = (a + bytes[i]) % 255;
+        b = (b + a) % 255;
+    }
+    return cast(u16)((b << 8) | a);
+}
+
+u16 calculate_program_checksum(void) {
+    u16 result = 0;
+    for(s24 i = 0; i <= program.size - 1; ++i) {
+        u8 byte = get_program_byte(i);
+        result = update_checksum(result, &byte, 1);
+    }
+    return result;
+}
+
+void get_undo_journal_name(u8 *program_name, char *result) {
+    const char *characters = "0123456789ABCDEFGHIJKLMNOPQRSTUV";
+    u32 hash = 2166136261; // NOTE: FNV-1a
+    for(u8 i = 0; i < 8 && program_name[i] != 0; ++i) {
+        hash = (hash ^ program_name[i]) * 16777619;
+    }
+    strcpy(result, UNDO_JOURNAL_APPVAR_PREFIX);
+    for(u8 i = 5; i < 8; ++i) {
+        result[i] = characters[hash & 31];
+        hash >>= 5;
+    }
+    result[8] = 0;
+}
+
+bool undo_journal_header_matches_program(UndoJournalHeader *header) {
+    bool result = header->version == UNDO_JOURNAL_VERSION && header->program_size == program.size;
+    for(u8 i = 0; result && i < ARRLEN(program.program_name); ++i) {
+        if(header->program_name[i] != program.program_name[i]) { result = false; }
+        if(program.program_name[i] == 0) { break; }
+    }
+    return result && header->program_checksum == program.loaded_checksum;
+}
+
+void open_undo_journal(void) {
+    program.undo_buffer.spills_to_journal = false;
+    program.undo_journal_count = 0;
+    get_undo_journal_name(program.program_name, program.undo_journal_name);
+
+    UndoJournalHeader header;
+    bool keep = false;
+    u8 handle = ti_Open(program.undo_journal_name, "r");
+    if(handle) {
+        if(ti_Read(&header, sizeof(UndoJournalHeader), 1, handle) == 1 && undo_journal_header_matches_program(&header)) {
+            // NOTE: It's archived between sessions, but we append to it
+            keep = !ti_IsArchived(handle) || ti_SetArchiveStatus(false, handle);
+        }
+        ti_Close(handle);
+    }
+
+    if(keep) {
+        program.undo_journal_count = header.delta_count;
+        program.undo_buffer.spills_to_journal = true;
+    } else {
+        handle = ti_Open(program.undo_journal_name, "w");
+        if(handle) {
+            zero(&header, sizeof(UndoJournalHeader));
+            header.version = UNDO_JOURNAL_VERSION;
+            program.undo_buffer.spills_to_journal = (ti_Write(&header, sizeof(UndoJournalHeader), 1, handle) == 1);
+            ti_Close(handle);
+        }
+    }
+}
+
+// NOTE: Deletes the journals of programs that are gone, or whose size changed since their journal was closed.
+// Journals of changed programs that kept their size are caught when the program is opened instead.
+// The open program's journal is left alone, its header is only written when it's closed.
+void drop_stale_undo_journals(void) {
+    bool dropped = true;
+    // NOTE: Deleting a variable moves the VAT around, so the walk starts over after each one
+    while(dropped) {
+        dropped = false;
+        void *it = null;
+        char *found;
+        while(!dropped && (found = ti_DetectVar(&it, null, OS_TYPE_APPVAR)) != null) {
+            char name[9] = {};
+            strncpy(name, found, 8);
+            bool journal = strncmp(name, UNDO_JOURNAL_APPVAR_PREFIX, 5) == 0 &&
+                           !(program.program_loaded && strcmp(name, program.undo_journal_name) == 0);
+            if(journal) {
+                bool stale = true;
+                u8 handle = ti_Open(name, "r");
+                if(handle) {
+                    UndoJournalHeader header;
+                    if(ti_Read(&header, sizeof(UndoJournalHeader), 1, handle) == 1) {
+                        u8 of = ti_OpenVar(cast(char*)header.program_name, "r", OS_TYPE_PRGM);
+                        if(of) {
+                            stale = ti_GetSize(of) != header.program_size;
+                            ti_Close(of);
+                        }
+                    }
+                    ti_Close(handle);
+                }
+                if(stale) {
+                    log("Dropping undo journal %s\n", name);
+                    ti_Delete(name);
+                    dropped = true;
+                }
+            }
+        }
+    }
+}
+
+// NOTE: The journal is full. Throws away its oldest half, which is rare enough that moving the rest down is fine.
+void drop_oldest_undo_journal_deltas(u8 journal) {
+    u24 size = cast(u24)ti_GetSize(journal) - sizeof(UndoJournalHeader);
+    ti_Seek(sizeof(UndoJournalHeader), SEEK_SET, journal);
+    u8 *deltas = cast(u8*)ti_GetDataPtr(journal);
+    u24 dropping = 0;
+    u24 dropped_count = 0;
+    while(dropping < size / 2 && dropped_count < program.undo_journal_count) {
+        dropping += size_of_delta(cast(Delta*)(deltas + dropping)) + sizeof(u16);
+        dropped_count += 1;
     }
-
+    copy_overlapping(deltas + dropping, deltas, cast(s24)(size - dropping));
+    ti_Resize(sizeof(UndoJournalHeader) + size - dropping, journal);
+    ti_Seek(0, SEEK_END, journal);
+    program.undo_journal_count -= dropped_count;
 }
 
-void save_program(bool are_we_exiting_so_we_should_do_a_final_archiving_of_the_variable) {
-    assert(program.program_loaded, "Program should be loaded");
-    if(program.program_loaded) {
-        u8 handle = ti_OpenVar((char*)program.program_name, "r", OS_TYPE_PRGM);
-        u16 space_that_will_be_freed = 0;
-        if(handle) {
-            if(!ti_IsArchived(handle)) {
-                space_that_will_be_freed = ti_GetSize(handle);
-            }
-            ti_Close(handle);
+// NOTE: journal is opened the first time and left open so evicting several deltas only opens the appvar once.
+// The caller closes it.
+void spill_delta_to_undo_journal(u8 *journal, Delta *delta) {
+    if(*journal == 0) {
+        *journal = ti_Open(program.undo_journal_name, "r+");
+        if(*journal) {
+            ti_Seek(0, SEEK_END, *journal);
+        } else {
+            // NOTE: Somebody deleted it. Stop spilling, the deltas it had are gone anyway.
+            program.undo_buffer.spills_to_journal = false;
+            program.undo_journal_count = 0;
         }
-        void *unused;
-        u24 free_ram = os_MemChk(&unused);
-        bool has_room = cast(s24)free_ram >= (cast(s24)program.size - cast(s24)space_that_will_be_freed);
-        if(has_room) {
-            // ti_DeleteVar(cast(char*)program.program_name, OS_TYPE_PRGM);
-            handle = ti_OpenVar(cast(char*)program.program_name, "w", OS_TYPE_PRGM);
-            u24 written = ti_Write(program.data, 1, cast(u24)program.size, handle);
-            assert(cast(s24)written == program.size, "Didn't write full program... %d/%d", written, program.size);
-            if(are_we_exiting_so_we_should_do_a_final_archiving_of_the_variable) {
-                ti_SetArchiveStatus(program.archived, handle);
-            }
-            I_KNOW_ITS_UNUSED(written);
-            ti_Close(handle);
+    }
+    if(*journal) {
+        u16 size = cast(u16)size_of_delta(delta);
+        if(cast(u24)ti_GetSize(*journal) + size + sizeof(u16) > UNDO_JOURNAL_MAX_SIZE) {
+            drop_oldest_undo_journal_deltas(*journal);
+        }
+        bool written = ti_Write(delta, size, 1, *journal) == 1 && ti_Write(&size, sizeof(u16), 1, *journal) == 1;
+        if(written) {
+            program.undo_journal_count += 1;
         } else {
-            // TODO: We probably want to open a "go archive some programs" wizard
-            // so the user can still manage to save instead of losing their data...
-            // The good thing is autosave will make this not so bad
-            assert(false, "Not enough room to write appvar");
-            exit_with_message("Not enough RAM to save");
+            // NOTE: Out of RAM. Undoing past a missing delta would undo into garbage, so the journal starts over from here.
+            ti_Resize(sizeof(UndoJournalHeader), *journal);
+            ti_Seek(0, SEEK_END, *journal);
+            program.undo_journal_count = 0;
         }
     }
 }
 
-void open_directory(u8 index) {
-    program.opened_directory = &directories[index];
-    program.opened_directory_list_index = 0;
-    program.opened_directory_token_index = 0;
+void empty_undo_journal(void) {
+    u8 journal = ti_Open(program.undo_journal_name, "r+");
+    if(journal) {
+        ti_Resize(sizeof(UndoJournalHeader), journal);
+        ti_Close(journal);
+    }
+    program.undo_journal_count = 0;
 }
 
-bool save_clipboard(s24 at, s24 size) {
-    assert(size >= 0 && size <= PROGRAM_DATA_SIZE, "Too big clipboard save");
-    bool success = false;
-    u8 clipboard_handle = ti_Open(CLIPBOARD_APPVAR_NAME, "w");
-    if(clipboard_handle) {
-        u24 written = ti_Write(program.data + at, cast(u24)size, 1, clipboard_handle);
-        if(written == 1) {
-            success = true;
-            if(ti_ArchiveHasRoomVar(clipboard_handle)) {
-                ti_SetArchiveStatus(true, clipboard_handle);
+// NOTE: Called when undo_buffer is empty. Moves the newest deltas on the journal back into it,
+// up to half of it so the undos after them don't immediately spill again. Returns whether there were any.
+bool page_in_undo_journal(void) {
+    bool result = false;
+    if(program.undo_journal_count > 0 && program.undo_buffer.delta_count == 0) {
+        u8 journal = ti_Open(program.undo_journal_name, "r+");
+        if(journal) {
+            u24 end = cast(u24)ti_GetSize(journal);
+            u24 start = end;
+            u24 taking = 0;
+            while(taking < program.undo_journal_count) {
+                u16 size = 0;
+                ti_Seek(cast(int)(start - sizeof(u16)), SEEK_SET, journal);
+                ti_Read(&size, sizeof(u16), 1, journal);
+                if(size < sizeof(Delta) || start - sizeof(UndoJournalHeader) < size + sizeof(u16)) {
+                    assert(false, "Undo journal is broken");
+                    program.undo_journal_count = taking;
+                    break;
+                }
+                if(taking > 0 && (end - start) + size + sizeof(u16) > DELTA_COLLECTION_SIZE / 2) {
+                    break;
+                }
+                start -= size + sizeof(u16);
+                taking += 1;
+            }
+
+            ti_Seek(cast(int)start, SEEK_SET, journal);
+            for(u24 i = 0; i < taking; ++i) {
+                Delta delta;
+                ti_Read(&delta, sizeof(Delta), 1, journal);
+                u24 size = size_of_delta(&delta);
+                Delta *placed_at = push_delta(&program.undo_buffer, &delta, sizeof(Delta), size);
+                assert(placed_at != null, "Paged in more than fits");
+                if(placed_at && size > sizeof(Delta)) {
+                    ti_Read(cast(u8*)placed_at + sizeof(Delta), size - sizeof(Delta), 1, journal);
+                }
+                ti_Seek(sizeof(u16), SEEK_CUR, journal);
             }
+            ti_Resize(start, journal);
+            program.undo_journal_count -= taking;
+            result = taking > 0;
+            ti_Close(journal);
         }
-        ti_Close(clipboard_handle);
-        if(!success) { ti_Delete(CLIPBOARD_APPVAR_NAME); }
     }
-    return success;
+    return result;
+}
+
+void close_undo_journal(void) {
+    if(program.undo_buffer.spills_to_journal) {
+#if KEEP_UNDO_JOURNAL_BETWEEN_SESSIONS
+        // NOTE: Everything in RAM goes on top, oldest first, so next time undo carries on where it left off
+        u8 journal = 0;
+        u24 it = program.undo_buffer.tail;
+        for(u24 i = 0; i < program.undo_buffer.delta_count; ++i) {
+            spill_delta_to_undo_journal(&journal, cast(Delta*)(program.undo_buffer.data + it));
+            it = next_delta_offset(&program.undo_buffer, it);
+        }
+        if(journal == 0) {
+            journal = ti_Open(program.undo_journal_name, "r+");
+        }
+        if(journal) {
+            UndoJournalHeader header;
+            zero(&header, sizeof(UndoJournalHeader));
+            header.version = UNDO_JOURNAL_VERSION;
+            copy(program.program_name, header.program_name, ARRLEN(header.program_name));
+            header.program_size = cast(u16)program.size;
+            header.program_checksum = calculate_program_checksum();
+            header.delta_count = program.undo_journal_count;
+            ti_Seek(0, SEEK_SET, journal);
+            ti_Write(&header, sizeof(UndoJournalHeader), 1, journal);
+            ti_Close(journal);
+        }
+        if(program.undo_journal_count == 0) {
+            ti_Delete(program.undo_journal_name);
+        }
+#else
+        ti_Delete(program.undo_journal_name);
+#endif
+    }
+}
+
+// NOTE: On exit, after program.data_released. See archive_variable.
+void archive_undo_journal(void) {
+    u8 journal = ti_Open(program.undo_journal_name, "r");
+    if(journal) {
+        archive_variable(journal);
+        ti_Close(journal);
+    }
 }
 
 // NOTE: Returns number of bytes pasted
@@ -1369,10 +4292,14 @@ s24 paste_clipboard(s24 at) {
     u8 handle = ti_Open(CLIPBOARD_APPVAR_NAME, "r");
     if(handle != 0) {
         u16 size = ti_GetSize(handle);
-        u8 *data = ti_GetDataPtr(handle);
-        insert_tokens(at, data, size);
+        // NOTE: Make room in the window first, that can move the clipboard's data around
+        if(fit_program_window(at, at, size)) {
+            u8 *data = ti_GetDataPtr(handle);
+            s24 size_was = program.size;
+            insert_tokens(at, data, size);
+            amount_pasted = program.size - size_was;
+        }
         ti_Close(handle);
-        amount_pasted = cast(s24)size;
     }
     return amount_pasted;
 }
@@ -1383,9 +4310,19 @@ void update(void) {
     // if we do that operation repeatedly and want to not iterate over linebreaks in the program much.
     s24 cursor_y = calculate_cursor_y();
 
+    if(program.notice && any_key_pressed()) {
+        program.notice = null;
+    }
+
     if(on_pressed) {
-        editor.settings.light_mode = !editor.settings.light_mode;
-        update_editor_theme_based_on_settings();
+        if(editor.cursor_mode == CursorMode_Second) {
+            profiler.visible = !profiler.visible;
+            editor.cursor_mode = CursorMode_Normal;
+        } else {
+            editor.settings.light_mode = !editor.settings.light_mode;
+            update_editor_theme_based_on_settings();
+        }
+        program.redraw_all = true;
     }
 
     if(key_down[1] & kb_2nd) {
@@ -1461,31 +4398,20 @@ void update(void) {
         if(key_down[6] & kb_Enter) {
             program.entering_goto = false;
             if(program.entering_goto_chars_count > 0) {
-                for(int i = 0; i <= program.size - 1;) {
-                    if(program.data[i] == LBL) {
-                        u8 entering_index = 0;
-                        bool failed = false;
-                        for(int j = i + 1; j <= min(i + 2, program.size - 1);) {
-                            if((program.data[j] >= '0' && program.data[j] <= '9') ||
-                               (program.data[j] >= 'A' && program.data[j] <= 'Z')) {
-                                if(program.data[j] != program.entering_goto_chars[entering_index]) {
-                                    failed = true;
-                                    break;
-                                }
-                                entering_index += 1;
-                            } else {
-                                break;
-                            }
-                            j += get_token_size(j);
-                        }
-                        if(failed == false && entering_index == program.entering_goto_chars_count) {
-                            program.cursor = i;
-                            cursor_y = calculate_cursor_y();
-                            program.view_top_line = max(0, cursor_y - 11);
-                            break;
-                        }
-                    }
-                    i += get_token_size(i);
+#if DEBUG
+                u24 goto_started_clock = cast(u24)clock();
+#endif
+                u16 name = 0;
+                for(u8 i = 0; i <= program.entering_goto_chars_count - 1; ++i) {
+                    name = cast(u16)((name << 8) | program.entering_goto_chars[i]);
+                }
+                s24 label_at = find_label_named(name);
+#if DEBUG
+                u24 goto_ms = ((cast(u24)clock() - goto_started_clock) * 1000) / cast(u24)CLOCKS_PER_SEC;
+                log("Goto took %dms with %d labels in %d bytes\n", goto_ms, program.labels_count, program.size);
+#endif
+                if(label_at != -1) {
+                    cursor_y = go_to_label(label_at);
                 }
             }
         }
@@ -1550,6 +4476,12 @@ void update(void) {
             }
         }
 
+        if(key_down[1] & kb_Yequ && program.program_sort != ProgramSort_Name) {
+            sort_programs(ProgramSort_Name);
+        } else if(key_down[1] & kb_Window && program.program_sort != ProgramSort_Size) {
+            sort_programs(ProgramSort_Size);
+        }
+
         if(key_down[6] & kb_Enter && program.selected_program >= 0 && program.selected_program <= os_programs_count - 1) {
             assert(os_programs_count != 0, "Shouldn't be able to reach this logically");
             char *stored_name = (char*)os_programs[program.selected_program].name;
@@ -1562,6 +4494,7 @@ void update(void) {
                 blit_loading_indicator();
                 load_program((char*)editor.settings.last_editing_program);
                 u16 cursor_y = editor.settings.last_cursor_y;
+                index_program_through_line(cursor_y);
                 if(cursor_y >= program.linebreaks_count) {
                     cursor_y = cast(u16)program.linebreaks_count - 1;
                 }
@@ -1569,6 +4502,19 @@ void update(void) {
             }
         }
 
+    } else if(program.browsing_labels) {
+        // NOTE: Label list
+        if(key_down[6] & kb_Clear) program.browsing_labels = false;
+        if(program.labels_count > 0) {
+            if(key_debounced[7] & kb_Up) program.label_browser_index -= 1;
+            if(key_debounced[7] & kb_Down) program.label_browser_index += 1;
+            if(program.label_browser_index < 0) program.label_browser_index += program.labels_count;
+            if(program.label_browser_index >= program.labels_count) program.label_browser_index -= program.labels_count;
+            if(key_down[6] & kb_Enter) {
+                program.browsing_labels = false;
+                cursor_y = go_to_label(program.labels[program.label_browser_index]);
+            }
+        }
     } else if(program.opened_directory) {
         // NOTE: Token selector
 
@@ -1706,7 +4652,13 @@ void update(void) {
     } else {
         // NOTE: Editor
 
-        if(key_down[6] & kb_Clear) editor.running = false;
+        if(key_down[6] & kb_Clear) {
+            if(editor.cursor_mode == CursorMode_Second && program.search_size != 0) {
+                clear_search_tokens();
+            } else {
+                editor.running = false;
+            }
+        }
 
         if(editor.cursor_mode == CursorMode_Normal) {
             if(key_down[4] & kb_Prgm) { open_directory(DIR_PRGM); }
@@ -1800,6 +4752,8 @@ void update(void) {
             if(key_down[5] & kb_Vars ) { open_directory(DIR_DISTR); }
             if(key_down[4] & kb_Stat ) { open_directory(DIR_LIST); }
 
+            if(key_down[3] & kb_GraphVar) { open_label_browser(); }
+
             #define M(prefix,token) (u16)((((u16)token) << 8) | (u16)prefix)
             if(key_down[3] & kb_Sin)   { insert_token_u8(program.cursor, OS_TOK_INV_SIN); program.cursor += 1; }
             if(key_down[4] & kb_Cos)   { insert_token_u8(program.cursor, OS_TOK_INV_COS); program.cursor += 1; }
@@ -1832,6 +4786,10 @@ void update(void) {
         }
         
         if(key_down[1] & kb_Graph) {
+            program.undo_merge_open = false;
+            if(program.undo_buffer.delta_count == 0) {
+                page_in_undo_journal();
+            }
             Delta* undo = pop_delta(&program.undo_buffer);
             if(undo) {
                 apply_delta_to_program(undo, &program.redo_buffer);
@@ -1840,6 +4798,7 @@ void update(void) {
         }
         
         if(key_down[1] & kb_Trace) {
+            program.undo_merge_open = false;
             Delta* redo = pop_delta(&program.redo_buffer);
             if(redo) {
                 apply_delta_to_program(redo, &program.undo_buffer);
@@ -1908,7 +4867,7 @@ void update(void) {
             s24 line_start = get_linebreak_location(cursor_y) + 1;
             s24 before_line_break_or_end_of_program = program.size - 1;
             for(s24 i = line_start; i <= program.size - 1;) {
-                if(program.data[i] == LINEBREAK) {
+                if(get_program_byte(i) == LINEBREAK) {
                     before_line_break_or_end_of_program = i - 1;
                     break;
                 }
@@ -1926,30 +4885,44 @@ void update(void) {
             }
         }
         if(key_debounced[6] & kb_Enter) {
-            insert_token_u8(program.cursor, LINEBREAK);
-            program.cursor += 1;
+            if(editor.cursor_mode == CursorMode_Second && program.search_size != 0) {
+                replace_all_matches();
+            } else {
+                insert_token_u8(program.cursor, LINEBREAK);
+                program.cursor += 1;
+            }
+            cursor_y = calculate_cursor_y();
         }
         if(key_debounced[7] & kb_Down) {
-            s24 target_cursor = cursor_y;
-            if(editor.cursor_mode == CursorMode_Alpha) target_cursor += 8;
-            else target_cursor += 1;
-            if(target_cursor >= program.linebreaks_count - 1) target_cursor = program.linebreaks_count - 1;
-            program.cursor = get_linebreak_location(target_cursor) + 1;
+            if(editor.cursor_mode == CursorMode_Second) {
+                search_from_cursor(false);
+                cursor_y = calculate_cursor_y();
+            } else {
+                s24 target_cursor = cursor_y;
+                if(editor.cursor_mode == CursorMode_Alpha) target_cursor += 8;
+                else target_cursor += 1;
+                if(target_cursor >= program.linebreaks_count - 1) target_cursor = program.linebreaks_count - 1;
+                program.cursor = get_linebreak_location(target_cursor) + 1;
+            }
         }
         if(key_debounced[7] & kb_Up) {
-            s24 target_cursor = cursor_y;
-            if(editor.cursor_mode == CursorMode_Alpha) target_cursor -= 8;
-            else target_cursor -= 1;
-            if(target_cursor < 0) target_cursor = 0;
-            program.cursor = get_linebreak_location(target_cursor) + 1;
+            if(editor.cursor_mode == CursorMode_Second) {
+                search_from_cursor(true);
+                cursor_y = calculate_cursor_y();
+            } else {
+                s24 target_cursor = cursor_y;
+                if(editor.cursor_mode == CursorMode_Alpha) target_cursor -= 8;
+                else target_cursor -= 1;
+                if(target_cursor < 0) target_cursor = 0;
+                program.cursor = get_linebreak_location(target_cursor) + 1;
+            }
         }
         if(key_debounced[7] & kb_Left) {
             if(editor.cursor_mode == CursorMode_Second) {
                 program.cursor = get_linebreak_location(cursor_y) + 1;
             } else {
                 if(program.cursor > 0) {
-                    u8 prev_token_size = get_token_size(program.cursor - 1);
-                    program.cursor -= prev_token_size;
+                    program.cursor = get_previous_token_start(program.cursor);
                 }
             }
         }
@@ -1967,6 +4940,9 @@ void update(void) {
             }
         }
     }
+
+    keep_program_window_around_cursor();
+    keep_program_indexed_around_cursor();
 }
 
 Range get_selecting_range() {
@@ -1984,21 +4960,23 @@ Range get_selecting_range() {
 }
 
 // NOTE: Always either 1 or 2.
-// Can pass a position that's on the first or second byte of a token
+// pos has to be where a token starts. The second byte of a token can be the same as a prefix,
+// so there's no telling from the bytes around it whether pos is in the middle of one.
+// Use get_previous_token_start to step back.
 u8 get_token_size(s24 pos) {
+    return get_token_size_from_first_byte(get_program_byte(pos));
+}
+
+// NOTE: The same for tokens that aren't in the program, like ones about to be inserted.
+// Walk them with this rather than looking at every byte: 2-PropZTest( is 0xBB 0x3F, and 0x3F is LINEBREAK.
+u8 get_token_size_from_first_byte(u8 x) {
     u8 result = 1;
-    u8 x = program.data[pos];
+    // NOTE: 0x7E is the prefix of the graph format tokens (see the token directories). 0x7B is IndpntAsk.
     #define IS_TWOBYTE(x) \
-        (x == 0x5C || x == 0x5D || x == 0x5E || x == 0x60 || x == 0x61 || x == 0x62 || x == 0x63 || x == 0xAA || x == 0x7B || x == 0xBB || x == 0xEF)
+        (x == 0x5C || x == 0x5D || x == 0x5E || x == 0x60 || x == 0x61 || x == 0x62 || x == 0x63 || x == 0xAA || x == 0x7E || x == 0xBB || x == 0xEF)
     if(IS_TWOBYTE(x)) {
         result = 2;
     }
-    if(result == 1 && pos > 0) {
-        u8 x = program.data[pos - 1];
-        if(IS_TWOBYTE(x)) {
-            result = 2;
-        }
-    }
     return result;
 }
 
@@ -2010,8 +4988,9 @@ void convert_byte_to_hex(u8 input, char *result) {
 }
 
 void blit_loading_indicator(void) {
-    gfx_BlitScreen();
-
+    // NOTE: The draw buffer already matches the screen, so only the indicator needs to go over.
+    // (With SINGLE_BUFFERED we're drawing on the screen anyway.)
+    // Whatever is loading will redraw everything afterwards.
     gfx_SetColor(editor.background_color);
     #define LOADING_INDICATOR_WIDTH 40
     fontlib_SetForegroundColor(editor.foreground_color);
@@ -2021,12 +5000,147 @@ void blit_loading_indicator(void) {
     draw_string("...", (320/2) - ((FONT_WIDTH*3)/2), 1);
     #undef LOADING_INDICATOR_WIDTH
 
-    gfx_SwapDraw();
+#if !SINGLE_BUFFERED
+    gfx_BlitLines(gfx_buffer, 0, FONT_HEIGHT + 2);
+#endif
 }
 
-void render(void) {
+// NOTE: Draws one line of the program with its top at y and returns the x it ended at.
+// The row has to be cleared to the background color already.
+s24 render_editor_line(s24 line, u8 y, Range selection) {
+    s24 max_width = EDITOR_TEXT_WIDTH;
+    s24 x = 5;
+    s24 chars_until_line = -program.view_first_character;
+    s24 indentation_level = get_linebreak(line)->indentation;
+    if(chars_until_line < 0) {
+        s24 change = min(-chars_until_line, indentation_level);
+        chars_until_line += change;
+        indentation_level -= change;
+    }
+    x += indentation_level * FONT_WIDTH;
+
+    s24 i = get_linebreak_location(line) + 1;
+    if(chars_until_line < 0) {
+        // NOTE: Scrolled past the indentation, so skip to the closest checkpoint before the first visible character
+        s24 column;
+        i = find_column_in_line(line, -chars_until_line, &column);
+        chars_until_line += column;
+    }
+    s24 tokens_skipped = 0;
+    // NOTE: Search matches are found from where they start. When scrolled sideways, the walk starts at a checkpoint,
+    // so a match that started before it isn't highlighted.
+    s24 search_match_end = -1;
+    for(; i < program.size && x < max_width;) {
+        if(chars_until_line < 0) { tokens_skipped += 1; }
+        bool on_cursor = (i == program.cursor);
+        bool selected;
+        if(program.cursor_selecting) {
+            selected = i >= selection.min && i <= selection.max;
+        } else {
+            selected = on_cursor;
+        }
+        if(program.search_size != 0 && i >= search_match_end && search_matches_at(i)) {
+            search_match_end = i + program.search_size;
+        }
+        bool matched = i < search_match_end;
+        s24 str_length = 0;
+        char *str;
+        u8 byte_0 = get_program_byte(i);
+        u8 token_size = get_token_size(i);
+        
+        if(byte_0 != LINEBREAK && byte_0 != SPACE) {
+            u24 str_length_unsigned;
+            str = get_token_string(get_program_token_pointer(i), &str_length_unsigned);
+            str_length = cast(s24)str_length_unsigned;
+        }
+        
+        i += token_size;
+        
+        bool break_line = false;
+        
+        if(chars_until_line < 0 && str_length > 0) {
+            s24 amount_to_move = min(str_length, -chars_until_line);
+            str_length -= amount_to_move;
+            str += amount_to_move;
+            chars_until_line += amount_to_move;
+        }
+
+        if(str_length > 0) {
+            s24 start = x;
+            s24 end = x + cast(s24)str_length*FONT_WIDTH;
+            s24 max_chars = (min(max_width, end) - start) / FONT_WIDTH;
+            if(end > max_width) {
+                break_line = true;
+            }
+            if(max_chars > 0) {
+                GlyphColors colors = selected ? GlyphColors_Selected : matched ? GlyphColors_Inverted : GlyphColors_Normal;
+                draw_glyphs(str, (u24)max_chars, (u24)x, y, colors);
+            }
+        } else if((selected || matched) && (byte_0 == LINEBREAK || byte_0 == SPACE)) {
+            u24 length_of_rect;
+            if(byte_0 == LINEBREAK) { length_of_rect = FONT_WIDTH/2; }
+            if(byte_0 == SPACE) { length_of_rect = FONT_WIDTH; }
+            gfx_SetColor(selected ? editor.highlight_color : editor.foreground_color);
+            gfx_FillRectangle_NoClip(cast(u24)x,y,length_of_rect,FONT_HEIGHT);
+            gfx_SetColor(editor.foreground_color);
+        }
+
+        if(on_cursor && !program.cursor_selecting) {
+            u24 length_of_rect = FONT_WIDTH;
+            if(str_length > 0) { length_of_rect = cast(u24)min(str_length*FONT_WIDTH, max_width - x); }
+            gfx_FillRectangle_NoClip(cast(u24)x,y+FONT_HEIGHT+1,length_of_rect,1);
+            gfx_FillRectangle_NoClip(cast(u24)x-1,y,1,FONT_HEIGHT);
+        }
+        if(str_length > 0) {
+            x += str_length*FONT_WIDTH;
+        }
+        if(byte_0 == SPACE) { if(chars_until_line < 0) { chars_until_line += 1; } else { x += FONT_WIDTH; } }
+        if(byte_0 == LINEBREAK) { break_line = true; }
+        
+        if(break_line) {
+            break;
+        }
+    }
+    if(tokens_skipped > 2*LINE_CHECKPOINT_SPACING) {
+        index_line_checkpoints(line);
+    }
+    return x;
+}
+
+// NOTE: Draws one of the 2 pixel wide bars in the sidebar and the background above and below it,
+// so every pixel of the column is written once and the bar doesn't flicker when we draw on the screen.
+void draw_sidebar_bar(u24 x, u8 bar_y, u8 bar_height) {
+    gfx_SetColor(editor.background_color);
+    if(bar_y > 0) { gfx_FillRectangle_NoClip(x, 0, 2, bar_y); }
+    u24 bar_end = cast(u24)bar_y + bar_height;
+    if(bar_end < 240) { gfx_FillRectangle_NoClip(x, cast(u8)bar_end, 2, cast(u8)(240 - bar_end)); }
+    gfx_SetColor(editor.foreground_color);
+    if(bar_height > 0) { gfx_FillRectangle_NoClip(x, bar_y, 2, bar_height); }
+}
 
-    gfx_FillScreen(editor.background_color);
+void render(void) {
+    // NOTE: The editor view keeps what it drew last frame and only repaints what changed.
+    // Every other screen is drawn from scratch, but only when something on it changed.
+    bool editor_view = program.program_loaded && program.opened_directory == null && !program.browsing_labels;
+    s24 menu_selection = !program.program_loaded ? program.selected_program :
+                         program.browsing_labels ? program.label_browser_index : program.opened_directory_token_index;
+    bool menu_changed = !program.drawn_menu ||
+                        program.drawn_directory != program.opened_directory ||
+                        program.drawn_browsing_labels != program.browsing_labels ||
+                        program.drawn_menu_list_index != program.opened_directory_list_index ||
+                        program.drawn_menu_selection != menu_selection ||
+                        program.drawn_cursor_mode != editor.cursor_mode ||
+                        program.drawn_alpha_is_lowercase != editor.alpha_is_lowercase ||
+                        program.drawn_entering_goto != program.entering_goto;
+    bool full_redraw = program.redraw_all || (editor_view ? !program.drawn_editor_view || program.drawn_notice != program.notice : menu_changed);
+    if(!editor_view && !full_redraw) {
+        return;
+    }
+    if(full_redraw) {
+        gfx_FillScreen(editor.background_color);
+        frame_damage.everything = true;
+    }
+    bool redraw_goto_dialog = full_redraw;
     fontlib_SetForegroundColor(editor.foreground_color);
     fontlib_SetBackgroundColor(editor.background_color);
     fontlib_SetTransparency(true);
@@ -2054,18 +5168,15 @@ void render(void) {
                 fontlib_SetForegroundColor(editor.foreground_color);
             }
             char *name = (char*)os_programs[i].name;
-            draw_string_max_chars(name, 8, x, y);
-
-            bool archived = false;
-            u24 size_bar_width = 0;
-            u8 temp_handle = ti_OpenVar(name, "r", OS_TYPE_PRGM);
-            if(temp_handle) {
-                archived = (ti_IsArchived(temp_handle) != 0);
-                u24 size = ti_GetSize(temp_handle);
-                ti_Close(temp_handle);
-                const u24 max_width = x - 20;
-                size_bar_width = ((size * max_width) / 65535);
+            if(selected) {
+                draw_glyphs(name, 8, x, y, GlyphColors_Inverted);
+            } else {
+                draw_string_max_chars(name, 8, x, y);
             }
+
+            bool archived = os_programs[i].archived;
+            const u24 max_width = x - 20;
+            u24 size_bar_width = ((cast(u24)os_programs[i].size * max_width) / 65535);
             if(archived) { gfx_SetColor(0xD5); }
             else { gfx_SetColor(editor.foreground_color); }
             gfx_FillRectangle_NoClip(x + FONT_WIDTH*8 + 10, y, size_bar_width, FONT_HEIGHT);
@@ -2127,8 +5238,7 @@ void render(void) {
                     }
                 }
             } else {
-                u16 *ptr = (cast(u16*)list->tokens) + i;
-                str = ti_GetTokenString(cast(void**)&ptr, null, &str_length);
+                str = get_token_string(cast(u8*)(list->tokens + i), &str_length);
             }
 
             if(str_length == 0 || str_length >= 40) {
@@ -2160,21 +5270,55 @@ void render(void) {
             y += FONT_HEIGHT + 2;
         }
         fontlib_SetForegroundColor(editor.foreground_color);
-    } else {
-        s24 cursor_y = program.linebreaks_count - 1;
-        for(int i = 0; i <= program.linebreaks_count - 1; ++i) {
-            if(program.cursor <= get_linebreak_location(i)) {
-                cursor_y = i - 1;
-                break;
+    } else if(program.browsing_labels) {
+        const u8 COUNT_PER_SCREEN = 21;
+        if(program.label_browser_index - program.label_browser_view_top >= COUNT_PER_SCREEN) {
+            program.label_browser_view_top = program.label_browser_index - COUNT_PER_SCREEN;
+        }
+        if(program.label_browser_view_top > program.label_browser_index) {
+            program.label_browser_view_top = program.label_browser_index;
+        }
+
+        draw_string(program.labels_overflowed ? "Labels (not all of them)" : "Labels", 5, 5);
+        if(program.labels_count == 0) {
+            draw_string("No labels", 5, 15);
+        }
+        u8 y = 15;
+        for(s24 i = program.label_browser_view_top; i <= program.labels_count - 1 && i < program.label_browser_view_top + 22; ++i) {
+            s24 label_at = program.labels[i];
+            // NOTE: "Lbl XY" and the line number, right aligned after it
+            char text[] = "Lbl XY      ";
+            u24 text_length = 4;
+            u16 name = get_label_name(label_at);
+            if(name > 0xFF) { text[text_length] = cast(char)(name >> 8); text_length += 1; }
+            if(name != 0) { text[text_length] = cast(char)name; text_length += 1; }
+            for(u24 c = text_length; c <= ARRLEN(text) - 2; ++c) { text[c] = ' '; }
+            u24 line_number = cast(u24)calculate_line_y(label_at) + 1;
+            for(u24 c = ARRLEN(text) - 2; line_number != 0; --c) {
+                text[c] = cast(char)('0' + line_number % 10);
+                line_number /= 10;
+            }
+
+            bool selected = (i == program.label_browser_index);
+            u24 width = (ARRLEN(text) - 1)*FONT_WIDTH;
+            if(!selected) {
+                fontlib_SetForegroundColor(editor.foreground_color);
+            } else {
+                fontlib_SetForegroundColor(editor.background_color);
+                gfx_SetColor(editor.foreground_color);
+                gfx_FillRectangle_NoClip(4, y - 1, width + 4, FONT_HEIGHT + 2);
             }
+            draw_string_max_chars(text, ARRLEN(text) - 1, 6, y);
+            y += FONT_HEIGHT + 2;
         }
+        fontlib_SetForegroundColor(editor.foreground_color);
+    } else {
+        s24 cursor_y = calculate_cursor_y();
 
-        int x = 5;
-        u8 y = 5;
-        s24 max_width = 320 - (FONT_WIDTH+2);
+        s24 max_width = EDITOR_TEXT_WIDTH;
         s24 max_height = 240 - FONT_HEIGHT;
         s24 chars_per_line = max_width/FONT_WIDTH;
-        s24 lines_per_screen = (max_height / (FONT_HEIGHT + 2));
+        s24 lines_per_screen = (max_height / EDITOR_ROW_HEIGHT);
 
         if(cursor_y < program.view_top_line) {
             program.view_top_line = cursor_y;
@@ -2184,181 +5328,213 @@ void render(void) {
         }
 
         s24 bottom_line = min(program.linebreaks_count - 1, program.view_top_line + lines_per_screen);
-        if(program.linebreaks_dirty_indentation_min <= bottom_line) {
-            assert(program.linebreaks_dirty_indentation_min != 0, "How did line 0 get dirty?");
-            if(program.linebreaks_dirty_indentation_min != 0) {
-                s24 indentation = program.linebreaks[program.linebreaks_dirty_indentation_min - 1].indentation;
-                for(int i = program.linebreaks_dirty_indentation_min - 1; i <= bottom_line; ++i) {
-                    program.linebreaks[i].indentation = cast(u8)indentation;
-                    s24 first_loc = get_linebreak_location(i)+1;
-                    s24 second_loc = get_linebreak_location(i+1)-1;
-                    u8 byte = program.data[first_loc];
-                    change_indentation_based_on_byte(indentation, byte);
-                    if(second_loc != first_loc) {
-                        byte = program.data[second_loc];
-                        change_indentation_based_on_byte(indentation, byte);
-                    }
-                }
-                program.linebreaks_dirty_indentation_min = cast(u16)bottom_line + 1;
+        s24 indentation = get_line_indentation(program.view_top_line);
+        for(s24 i = program.view_top_line; i <= bottom_line; ++i) {
+            Linebreak *linebreak = get_linebreak(i);
+            if(linebreak->indentation != cast(u8)indentation) {
+                linebreak->indentation = cast(u8)indentation;
+                mark_lines_dirty(i, i);
             }
+            indentation = apply_indentation_step(unpack_indentation_step(linebreak->indentation_step), indentation);
         }
 
-        s24 cursor_char_in_line = 0;
-        {
-            s24 last_char_in_line = program.size - 1;
-            if(cursor_y + 1 <= program.linebreaks_count - 1) { last_char_in_line = get_linebreak_location(cursor_y + 1) - 1; }
-            for(int i = get_linebreak_location(cursor_y) + 1; i < last_char_in_line;) {
-                u8 byte_0 = program.data[i];
-                assert(byte_0 != LINEBREAK, "Impossible? Linebreak pointers misaligned?");
-                u24 str_length = 1;
-                if(byte_0 != SPACE) {
-                    u8 *ptr = program.data + i;
-                    char *unused = ti_GetTokenString(cast(void**)&ptr, null, &str_length);
-                    I_KNOW_ITS_UNUSED(unused);
-                }
-                if(i == program.cursor) {
-                    break;
-                }
-                cursor_char_in_line += str_length;
-                i += get_token_size(i);
-            }
-        }
-        cursor_char_in_line += program.linebreaks[cursor_y].indentation;
+        // NOTE: This used to walk the whole cursor line every frame, which was super laggy at the end of very long lines
+        s24 cursor_char_in_line = get_linebreak(cursor_y)->indentation + get_column_of_offset(cursor_y, program.cursor);
         if(cursor_char_in_line <= chars_per_line - 2) {
             program.view_first_character = 0;
         } else {
             program.view_first_character = (cursor_char_in_line - cast(s24)chars_per_line/cast(s24)2);
         }
 
-        int first_token = get_linebreak_location(program.view_top_line) + 1;
-        s24 current_view_y = program.view_top_line;
-        Range selection;
+        Range selection = { 0, -1 };
         if(program.cursor_selecting) selection = get_selecting_range();
-        s24 chars_until_line = -program.view_first_character;
-        s24 indentation_level = program.linebreaks[program.view_top_line].indentation;
-        if(chars_until_line < 0) {
-            s24 change = min(-chars_until_line, indentation_level);
-            chars_until_line += change;
-            indentation_level -= change;
-        }
-        x += indentation_level * FONT_WIDTH;
 
-        // NOTE: On a stress test (DJ Omnimaga's pokewalrus data files), frame time is
-        // 13ms without this loop,
-        // 115ms with //draw_string commented out in this loop,
-        // 230ms with this entire loop uncommented.
-        for(int i = first_token; i < program.size;) {
-            bool on_cursor = (i == program.cursor);
-            bool selected;
-            if(program.cursor_selecting) {
-                selected = i >= selection.min && i <= selection.max;
-            } else {
-                selected = on_cursor;
-            }
-            s24 str_length = 0;
-            char *str;
-            u8 byte_0 = program.data[i];
-            u8 token_size = get_token_size(i);
-            
-            if(byte_0 != LINEBREAK && byte_0 != SPACE) {
-                u8 *ptr = program.data + i;
-                u24 str_length_unsigned;
-                str = ti_GetTokenString(cast(void**)&ptr, null, &str_length_unsigned);
-                str_length = cast(s24)str_length_unsigned;
-            }
-            
-            i += token_size;
-            
-            bool break_line = false;
-            
-            if(chars_until_line < 0 && str_length > 0) {
-                s24 amount_to_move = min(str_length, -chars_until_line);
-                str_length -= amount_to_move;
-                str += amount_to_move;
-                chars_until_line += amount_to_move;
-            }
-
-            if(str_length > 0) {
-                if(selected) { fontlib_SetTransparency(false); fontlib_SetBackgroundColor(editor.highlight_color); }
-                else { fontlib_SetTransparency(true); }
-                s24 start = x;
-                s24 end = x + cast(s24)str_length*FONT_WIDTH;
-                s24 max_chars = (min(max_width, end) - start) / FONT_WIDTH;
-                if(end > max_width) {
-                    break_line = true;
-                }
-                if(max_chars > 0) {
-                    draw_string_max_chars(str,(u24)max_chars, (u24)x,y);
+        // NOTE: Work out which rows of the screen have to be repainted.
+        // Everything else in the draw buffer is still what was drawn last frame.
+        u32 all_rows = (cast(u32)1 << EDITOR_ROW_COUNT) - 1;
+        u32 dirty_rows = 0;
+        if(full_redraw || program.view_first_character != program.drawn_view_first_character) {
+            dirty_rows = all_rows;
+        } else {
+            s24 scrolled_by = program.view_top_line - program.drawn_view_top_line;
+            if(scrolled_by != 0) {
+                // NOTE: Moving the rows would move the goto dialog or the profiler with them, so just redraw then
+                if(scrolled_by >= EDITOR_ROW_COUNT - 1 || scrolled_by <= -(EDITOR_ROW_COUNT - 1) || program.drawn_entering_goto || program.drawn_notice || profiler.visible) {
+                    dirty_rows = all_rows;
+                } else {
+                    // NOTE: Move the rows that are still on screen instead of redrawing them.
+                    // The bottom row is only partly on screen, so the row that moves into it is redrawn too.
+                    gfx_SetClipRegion(0, EDITOR_FIRST_ROW_Y, EDITOR_TEXT_WIDTH + 1, 240);
+                    if(scrolled_by > 0) {
+                        gfx_ShiftUp(cast(u24)(scrolled_by * EDITOR_ROW_HEIGHT));
+                        dirty_rows |= all_rows & ~((cast(u32)1 << (EDITOR_ROW_COUNT - 1 - scrolled_by)) - 1);
+                    } else {
+                        gfx_ShiftDown(cast(u24)(-scrolled_by * EDITOR_ROW_HEIGHT));
+                        dirty_rows |= (cast(u32)1 << -scrolled_by) - 1;
+                        // NOTE: The last row never holds text but a line just got moved into it
+                        dirty_rows |= cast(u32)1 << (EDITOR_ROW_COUNT - 1);
+                    }
+                    gfx_SetClipRegion(0, 0, 320, 240);
+                    frame_damage.text_area = true;
                 }
-            } else if(selected && (byte_0 == LINEBREAK || byte_0 == SPACE)) {
-                u24 length_of_rect;
-                if(byte_0 == LINEBREAK) { length_of_rect = FONT_WIDTH/2; }
-                if(byte_0 == SPACE) { length_of_rect = FONT_WIDTH; }
-                gfx_SetColor(editor.highlight_color);
-                gfx_FillRectangle_NoClip(cast(u24)x,y,length_of_rect,FONT_HEIGHT);
-                gfx_SetColor(editor.foreground_color);
             }
 
-            if(on_cursor && !program.cursor_selecting) {
-                u8 length_of_rect = FONT_WIDTH;
-                if(str_length > 0) { length_of_rect = cast(u8)str_length*FONT_WIDTH; }
-                gfx_FillRectangle_NoClip(cast(u24)x,y+FONT_HEIGHT+1,length_of_rect,1);
-                gfx_FillRectangle_NoClip(cast(u24)x-1,y,1,FONT_HEIGHT);
+            // NOTE: An edit moves the tokens after it, so the highlighted offsets may land on other lines
+            bool edited = program.dirty_line_min <= program.dirty_line_max;
+            if(edited ||
+               program.cursor != program.drawn_cursor ||
+               program.cursor_selecting != program.drawn_cursor_selecting ||
+               program.cursor_started_selecting != program.drawn_cursor_started_selecting) {
+                bool same_selection = !edited && program.cursor_selecting && program.drawn_cursor_selecting &&
+                                      program.cursor_started_selecting == program.drawn_cursor_started_selecting;
+                if(same_selection) {
+                    // NOTE: Only the end of the selection under the cursor moved
+                    mark_lines_dirty(min(cursor_y, program.drawn_cursor_y), max(cursor_y, program.drawn_cursor_y));
+                } else {
+                    mark_lines_dirty(program.drawn_highlight_min_line, program.drawn_highlight_max_line);
+                    mark_lines_dirty(cursor_y, cursor_y);
+                    if(program.cursor_selecting) {
+                        mark_lines_dirty(calculate_line_y(selection.min), calculate_line_y(selection.max));
+                    }
+                }
             }
-            if(str_length > 0) {
-                x += str_length*FONT_WIDTH;
+
+            if(!program.entering_goto && program.drawn_entering_goto) {
+                // NOTE: The goto dialog was drawn over these rows
+                dirty_rows |= GOTO_DIALOG_ROWS;
             }
-            if(byte_0 == SPACE) { if(chars_until_line < 0) { chars_until_line += 1; } else { x += FONT_WIDTH; } }
-            if(byte_0 == 0x3F) { break_line = true; }
-            
-            if(break_line) {
-                x = 5;
-                y += FONT_HEIGHT + 2;
-                current_view_y += 1;
-                chars_until_line = -program.view_first_character;
-                indentation_level = program.linebreaks[current_view_y].indentation;
-                if(chars_until_line < 0) {
-                    s24 change = min(-chars_until_line, indentation_level);
-                    chars_until_line += change;
-                    indentation_level -= change;
+
+            if(program.dirty_line_min <= program.dirty_line_max) {
+                s24 first_row = max(0, program.dirty_line_min - program.view_top_line);
+                s24 last_row = min(EDITOR_ROW_COUNT - 1, program.dirty_line_max - program.view_top_line);
+                for(s24 row = first_row; row <= last_row; ++row) {
+                    dirty_rows |= cast(u32)1 << row;
                 }
-                x += indentation_level * FONT_WIDTH;
-                if(current_view_y <= program.linebreaks_count - 1) {
-                    i = get_linebreak_location(current_view_y) + 1;
-                    if(current_view_y == program.linebreaks_count - 1) {
-                        // NOTE: Bottom line indicating end of file
-                        gfx_FillRectangle(0,y+FONT_HEIGHT+4,64,1);
+            }
+        }
+        // NOTE: Outside the else above, because sideways scrolling in the same frame doesn't clear the margin
+        if(!full_redraw && (editor.cursor_mode != program.drawn_cursor_mode || editor.alpha_is_lowercase != program.drawn_alpha_is_lowercase)) {
+            // NOTE: The cursor mode glyph pokes into the first row and the margin above it
+            gfx_SetColor(editor.background_color);
+            gfx_FillRectangle_NoClip(EDITOR_CURSOR_GLYPH_X, 0, FONT_WIDTH, EDITOR_FIRST_ROW_Y);
+            gfx_SetColor(editor.foreground_color);
+            dirty_rows |= 1;
+            frame_damage.cursor_glyph = true;
+        }
+
+        // NOTE: The end-of-program marker and cursor hang off the bottom of the last line,
+        // so the last line and the row after it are always drawn together.
+        s24 last_line_row = (program.linebreaks_count - 1) - program.view_top_line;
+        if(last_line_row >= 0 && last_line_row <= EDITOR_ROW_COUNT - 2) {
+            u32 both = (cast(u32)3 << last_line_row);
+            if(dirty_rows & both) { dirty_rows |= both; }
+        }
+
+        // NOTE: On a stress test (DJ Omnimaga's pokewalrus data files), frame time is
+        // 13ms without this loop,
+        // 115ms with //draw_string commented out in this loop,
+        // 230ms with this entire loop uncommented.
+        // That was for a full redraw. Now only the dirty rows go through here,
+        // and the glyphs are drawn with draw_glyphs instead of fontlib.
+        // DEBUG builds log how long the rows took so it can be compared.
+#if DEBUG
+        u24 rows_started_clock = cast(u24)clock();
+        u24 rows_drawn = 0;
+#endif
+        s24 last_line_end_x = 5;
+        for(s24 row = 0; row <= EDITOR_ROW_COUNT - 1; ++row) {
+            if((dirty_rows & (cast(u32)1 << row)) == 0) { continue; }
+#if DEBUG
+            rows_drawn += 1;
+#endif
+            u8 screen_y = cast(u8)(EDITOR_FIRST_ROW_Y + row*EDITOR_ROW_HEIGHT);
+            u8 height = cast(u8)min(EDITOR_ROW_HEIGHT, 240 - screen_y);
+#if SINGLE_BUFFERED
+            gfx_SetDrawBuffer();
+            u8 y = 0;
+#else
+            u8 y = screen_y;
+#endif
+            gfx_SetColor(editor.background_color);
+            gfx_FillRectangle_NoClip(0, y, EDITOR_TEXT_WIDTH + 1, height);
+            gfx_SetColor(editor.foreground_color);
+
+            s24 line = program.view_top_line + row;
+            if(row <= lines_per_screen - 1 && line <= program.linebreaks_count - 1) {
+                s24 x = render_editor_line(line, y, selection);
+                if(line == program.linebreaks_count - 1) {
+                    last_line_end_x = x;
+                    if(program.cursor >= program.size) {
+                        gfx_FillRectangle_NoClip(cast(u24)x,y+FONT_HEIGHT+1,FONT_WIDTH,1);
+                        gfx_FillRectangle_NoClip(cast(u24)x-1,y,2,FONT_HEIGHT);
                     }
-                } else {
-                    break;
+                }
+            } else if(line == program.linebreaks_count) {
+                // NOTE: Bottom line indicating end of file
+                gfx_FillRectangle_NoClip(0,y+2,64,1);
+                if(program.cursor >= program.size) {
+                    gfx_FillRectangle_NoClip(cast(u24)last_line_end_x,y,FONT_WIDTH,2);
                 }
             }
-            if(y >= max_height)
-            {
-                break;
-            }
+#if SINGLE_BUFFERED
+            gfx_CopyRectangle(gfx_buffer, gfx_screen, 0, y, 0, screen_y, EDITOR_TEXT_WIDTH + 1, height);
+            gfx_SetDrawScreen();
+#endif
         }
-        if(program.cursor >= program.size) {
-            gfx_FillRectangle_NoClip(cast(u24)x,y+FONT_HEIGHT+1,FONT_WIDTH,3);
-            gfx_FillRectangle_NoClip(cast(u24)x-1,y,2,FONT_HEIGHT);
+        frame_damage.rows |= dirty_rows;
+        if(dirty_rows & GOTO_DIALOG_ROWS) { redraw_goto_dialog = true; }
+#if DEBUG
+        if(rows_drawn != 0) {
+            u24 rows_ms = ((cast(u24)clock() - rows_started_clock) * 1000) / cast(u24)CLOCKS_PER_SEC;
+            log("Drew %d rows in %dms\n", rows_drawn, rows_ms);
         }
+#endif
 
+        program.drawn_view_top_line = program.view_top_line;
+        program.drawn_view_first_character = program.view_first_character;
+        program.drawn_cursor = program.cursor;
+        program.drawn_cursor_y = cursor_y;
+        program.drawn_cursor_selecting = program.cursor_selecting;
+        program.drawn_cursor_started_selecting = program.cursor_started_selecting;
+        program.drawn_highlight_min_line = cursor_y;
+        program.drawn_highlight_max_line = cursor_y;
+        if(program.cursor_selecting) {
+            program.drawn_highlight_min_line = calculate_line_y(selection.min);
+            program.drawn_highlight_max_line = calculate_line_y(selection.max);
+        }
+        program.dirty_line_min = LAST_LINE_POSSIBLE;
+        program.dirty_line_max = -1;
+
+        // NOTE: The scrollbar and undo/redo bars animate, so they're redrawn every frame.
+        // The space between them only ever holds background.
+        frame_damage.sidebar = true;
+
+        // NOTE: Keep rendering while any bar still moves. The lerps stop short of their target
+        // once the step rounds to 0, so it's whether they moved that counts.
+        s24 drawn_scroller_y = program.scroller_visual_y;
+        s24 drawn_undo_bar_height = program.undo_bar_visual_height;
+        s24 drawn_redo_bar_height = program.redo_bar_visual_height;
         s24 scrollbar_target_y = ((cast(s24)cursor_y * 230) / (cast(s24)program.linebreaks_count - 1));
         // NOTE: Lerp is x + (y-x)*a;
         program.scroller_visual_y = program.scroller_visual_y + (((scrollbar_target_y - program.scroller_visual_y) * 3) / 10);
-        gfx_FillRectangle_NoClip(320-2, cast(u8)program.scroller_visual_y, 2, 10);
+        draw_sidebar_bar(320-2, cast(u8)program.scroller_visual_y, 10);
         
-        s24 undo_bar_target_height = cast(s24)min(240, 3*program.undo_buffer.delta_count);
+        s24 undo_bar_target_height = cast(s24)min(240, 3*(program.undo_buffer.delta_count + program.undo_journal_count));
         program.undo_bar_visual_height = program.undo_bar_visual_height + (((undo_bar_target_height - program.undo_bar_visual_height) * 6) / 10);
         if(program.undo_bar_visual_height <= 3 && undo_bar_target_height == 0) { program.undo_bar_visual_height = 0; }
-        gfx_FillRectangle_NoClip(320-5,240-cast(u8)program.undo_bar_visual_height,2,cast(u8)program.undo_bar_visual_height);
+        draw_sidebar_bar(320-5, 240-cast(u8)program.undo_bar_visual_height, cast(u8)program.undo_bar_visual_height);
 
         s24 redo_bar_target_height = cast(s24)min(240, 3*program.redo_buffer.delta_count);
         program.redo_bar_visual_height = program.redo_bar_visual_height + (((redo_bar_target_height - program.redo_bar_visual_height) * 6) / 10);
         if(program.redo_bar_visual_height <= 3 && redo_bar_target_height == 0) { program.redo_bar_visual_height = 0; }
-        gfx_FillRectangle_NoClip(320-8,240-cast(u8)program.redo_bar_visual_height,2,cast(u8)program.redo_bar_visual_height);
+        draw_sidebar_bar(320-8, 240-cast(u8)program.redo_bar_visual_height, cast(u8)program.redo_bar_visual_height);
+        if(program.scroller_visual_y != drawn_scroller_y ||
+           program.undo_bar_visual_height != drawn_undo_bar_height ||
+           program.redo_bar_visual_height != drawn_redo_bar_height) {
+            editor.render_requested = true;
+        }
         
-        // log("%2x %2x [%2x] %2x %2x\n", program.data[program.cursor - 2], program.data[program.cursor - 1], program.data[program.cursor], program.data[program.cursor + 1], program.data[program.cursor+2]);
+        // log("%2x %2x [%2x] %2x %2x\n", get_program_byte(program.cursor - 2), get_program_byte(program.cursor - 1), get_program_byte(program.cursor), get_program_byte(program.cursor + 1), get_program_byte(program.cursor+2));
     }
     
     fontlib_SetTransparency(true);
@@ -2374,46 +5550,204 @@ void render(void) {
         }
     }
     if(cursor_glyph) {
-        draw_string(cursor_glyph, 320-(FONT_WIDTH+8), 2);
+        draw_string(cursor_glyph, EDITOR_CURSOR_GLYPH_X, 2);
+        frame_damage.cursor_glyph = true;
     }
 
     if(program.entering_goto) {
-        fontlib_SetTransparency(true);
-        fontlib_SetForegroundColor(editor.foreground_color);
         u24 rect_min_x = 160 - 40;
         u24 rect_max_x = 160 + 40;
         u8 rect_min_y = 120 - 20;
         u8 rect_max_y = 120 + 20;
         u24 rect_width = rect_max_x - rect_min_x;
         u8 rect_height = rect_max_y - rect_min_y;
+        if(redraw_goto_dialog || !program.drawn_entering_goto) {
+            gfx_SetColor(editor.background_color);
+            gfx_FillRectangle_NoClip(rect_min_x-2, rect_min_y-2, rect_width+4, rect_height+4);
+            gfx_SetColor(editor.foreground_color);
+            gfx_Rectangle_NoClip(rect_min_x, rect_min_y, rect_width, rect_height);
+        }
+        // NOTE: The digits are drawn over the old ones every frame, opaque so they never flicker
+        u24 digits_x = rect_min_x + 15;
+        u8 digits_y = 240/2 - FONT_HEIGHT/2;
+        u24 digits_count = program.entering_goto_chars_count;
+        draw_glyphs((char*)program.entering_goto_chars, digits_count, digits_x, digits_y, GlyphColors_Normal);
+        if(digits_count < ARRLEN(program.entering_goto_chars)) {
+            gfx_SetColor(editor.background_color);
+            gfx_FillRectangle_NoClip(digits_x + digits_count*FONT_WIDTH, digits_y,
+                                     (ARRLEN(program.entering_goto_chars) - digits_count)*FONT_WIDTH, FONT_HEIGHT);
+            gfx_SetColor(editor.foreground_color);
+        }
+        frame_damage.rows |= GOTO_DIALOG_ROWS;
+    }
+
+    // NOTE: Showing or hiding a notice redraws everything, and while it's shown it's drawn again
+    // whenever the rows under it were
+    if(editor_view && program.notice && redraw_goto_dialog) {
+        u24 notice_length = 0;
+        while(program.notice[notice_length] != 0) {
+            notice_length += 1;
+        }
+        u24 rect_width = notice_length*FONT_WIDTH + 20;
+        u24 rect_min_x = 160 - rect_width/2;
+        u8 rect_min_y = 120 - 20;
         gfx_SetColor(editor.background_color);
-        gfx_FillRectangle_NoClip(rect_min_x-2, rect_min_y-2, rect_width+4, rect_height+4);
+        gfx_FillRectangle_NoClip(rect_min_x-2, rect_min_y-2, rect_width+4, 40+4);
         gfx_SetColor(editor.foreground_color);
-        gfx_Rectangle_NoClip(rect_min_x, rect_min_y, rect_width, rect_height);
-        draw_string_max_chars((char*)program.entering_goto_chars, program.entering_goto_chars_count,
-                              rect_min_x + 15, 240/2 - FONT_HEIGHT/2);
+        gfx_Rectangle_NoClip(rect_min_x, rect_min_y, rect_width, 40);
+        draw_string(program.notice, rect_min_x + 10, 240/2 - FONT_HEIGHT/2);
+        frame_damage.rows |= GOTO_DIALOG_ROWS;
+    }
+
+    program.drawn_editor_view = editor_view;
+    program.drawn_entering_goto = program.entering_goto;
+    program.drawn_notice = program.notice;
+    program.drawn_menu = !editor_view;
+    program.drawn_directory = program.opened_directory;
+    program.drawn_browsing_labels = program.browsing_labels;
+    program.drawn_menu_list_index = program.opened_directory_list_index;
+    program.drawn_menu_selection = menu_selection;
+    program.drawn_cursor_mode = editor.cursor_mode;
+    program.drawn_alpha_is_lowercase = editor.alpha_is_lowercase;
+    program.redraw_all = false;
+}
+
+// NOTE: Copies what render() changed from the draw buffer to the screen.
+// We don't swap buffers anymore, so the draw buffer always holds the full last frame to draw over.
+void present_frame(void) {
+#if SINGLE_BUFFERED
+    // NOTE: render() already drew everything on the screen
+#else
+    if(frame_damage.everything) {
+        gfx_BlitBuffer();
+    } else {
+        if(frame_damage.text_area) {
+            gfx_BlitLines(gfx_buffer, EDITOR_FIRST_ROW_Y, 240 - EDITOR_FIRST_ROW_Y);
+        } else {
+            // NOTE: Copy runs of dirty rows with one blit each
+            for(s24 row = 0; row <= EDITOR_ROW_COUNT - 1;) {
+                if((frame_damage.rows & (cast(u32)1 << row)) == 0) { row += 1; continue; }
+                s24 first_row = row;
+                while(row <= EDITOR_ROW_COUNT - 1 && (frame_damage.rows & (cast(u32)1 << row))) { row += 1; }
+                s24 y = EDITOR_FIRST_ROW_Y + first_row*EDITOR_ROW_HEIGHT;
+                s24 height = min(240 - y, (row - first_row)*EDITOR_ROW_HEIGHT);
+                gfx_BlitLines(gfx_buffer, cast(u8)y, cast(u8)height);
+            }
+        }
+        if(frame_damage.cursor_glyph) {
+            gfx_BlitRectangle(gfx_buffer, EDITOR_CURSOR_GLYPH_X, 0, FONT_WIDTH, FONT_HEIGHT + 2);
+        }
+        if(frame_damage.sidebar) {
+            gfx_BlitRectangle(gfx_buffer, EDITOR_SIDEBAR_X, 0, 320 - EDITOR_SIDEBAR_X, 240);
+        }
+        if(frame_damage.profiler) {
+            gfx_BlitRectangle(gfx_buffer, PROFILER_X, PROFILER_Y, PROFILER_WIDTH, PROFILER_HEIGHT);
+        }
+    }
+#endif
+    zero(&frame_damage, sizeof(FrameDamage));
+}
+
+// NOTE: Clock ticks as tenths of a millisecond, so a 16 tick frame doesn't round to 0ms.
+u24 profile_ticks_to_tenths_of_ms(u24 ticks) {
+    return cast(u24)((cast(u32)ticks * 10000) / cast(u32)CLOCKS_PER_SEC);
+}
+
+// NOTE: Writes the ticks right aligned into the 6 characters at text, like " 123.4"
+void format_profile_ticks(u24 ticks, char *text) {
+    u24 tenths = min(profile_ticks_to_tenths_of_ms(ticks), 99999);
+    for(s24 c = 5; c >= 0; --c) {
+        text[c] = ' ';
+    }
+    text[5] = cast(char)('0' + tenths % 10);
+    text[4] = '.';
+    tenths /= 10;
+    s24 c = 3;
+    do {
+        text[c] = cast(char)('0' + tenths % 10);
+        tenths /= 10;
+        c -= 1;
+    } while(tenths != 0);
+}
+
+// NOTE: The min/avg/max of every phase, over the last PROFILE_SAMPLES times it ran, in a box over
+// the bottom right of the text area. It's drawn after render() every frame it's shown,
+// so whatever render() drew under it is covered again.
+void draw_profiler(void) {
+    gfx_SetColor(editor.background_color);
+    gfx_FillRectangle_NoClip(PROFILER_X, PROFILER_Y, PROFILER_WIDTH, PROFILER_HEIGHT);
+    gfx_SetColor(editor.foreground_color);
+    gfx_Rectangle_NoClip(PROFILER_X, PROFILER_Y, PROFILER_WIDTH, PROFILER_HEIGHT);
+    fontlib_SetForegroundColor(editor.foreground_color);
+    fontlib_SetBackgroundColor(editor.background_color);
+    fontlib_SetTransparency(true);
+    fontlib_SetFirstPrintableCodePoint(0);
+
+    u8 y = PROFILER_Y + 2;
+    draw_string("ms         min   avg   max", PROFILER_X + 2, y);
+    for(s24 phase = 0; phase <= ProfilePhase_Count - 1; ++phase) {
+        y += EDITOR_ROW_HEIGHT;
+        char text[PROFILER_COLUMNS + 1];
+        for(u24 c = 0; c <= PROFILER_COLUMNS - 1; ++c) { text[c] = ' '; }
+        text[PROFILER_COLUMNS] = 0;
+        char *name = profile_phase_names[phase];
+        for(u24 c = 0; name[c] != 0; ++c) { text[c] = name[c]; }
+
+        u8 count = profiler.samples_count[phase];
+        if(count == 0) {
+            text[PROFILER_COLUMNS - 1] = '-';
+        } else {
+            u24 least = 0xFFFFFF;
+            u24 most = 0;
+            u24 total = 0;
+            for(u8 i = 0; i <= count - 1; ++i) {
+                u24 sample = profiler.samples[phase][i];
+                least = min(least, sample);
+                most = max(most, sample);
+                total += sample;
+            }
+            format_profile_ticks(least, text + PROFILER_COLUMNS - 18);
+            format_profile_ticks(total / count, text + PROFILER_COLUMNS - 12);
+            format_profile_ticks(most, text + PROFILER_COLUMNS - 6);
+        }
+        draw_string(text, PROFILER_X + 2, y);
+    }
+    frame_damage.profiler = true;
+}
+
+#if DEBUG
+// NOTE: One line per frame with every phase that ran in it
+void log_profile_frame(void) {
+    log("frame %d:", profiler.frames);
+    for(s24 phase = 0; phase <= ProfilePhase_Count - 1; ++phase) {
+        if((profiler.ran_this_frame & (1 << phase)) == 0) { continue; }
+        u8 last = (profiler.next_sample[phase] + PROFILE_SAMPLES - 1) % PROFILE_SAMPLES;
+        u24 tenths = profile_ticks_to_tenths_of_ms(profiler.samples[phase][last]);
+        log(" %s %d.%dms", profile_phase_names[phase], tenths / 10, tenths % 10);
     }
+    log("\n");
 }
+#endif
 
 #if DEBUG
 void dump_deltas(char *title) {
     log("\n\n==+== %s\nUndo:\n", title);
-    Delta *it = (Delta*)program.undo_buffer.data;
+    u24 it = program.undo_buffer.tail;
     for(u24 i = 0; i < program.undo_buffer.delta_count; ++i) {
-        dump_delta("", it);
-        it = cast(Delta*)(cast(u8*)it + size_of_delta(it));
+        dump_delta("", cast(Delta*)(program.undo_buffer.data + it));
+        it = next_delta_offset(&program.undo_buffer, it);
     }
     
     log("\nRedo:\n");
-    it = (Delta*)program.redo_buffer.data;
+    it = program.redo_buffer.tail;
     for(u24 i = 0; i < program.redo_buffer.delta_count; ++i) {
-        dump_delta("", it);
-        it = cast(Delta*)(cast(u8*)it + size_of_delta(it));
+        dump_delta("", cast(Delta*)(program.redo_buffer.data + it));
+        it = next_delta_offset(&program.redo_buffer, it);
     }
 }
 void dump(char *dump_name) {
     log("\n%s:\n", dump_name);
-    assert(program.linebreaks[0].location_ == 0, "First linebreak should be undestructed");
+    assert(program.line_blocks[0].lines[0].location_ == 0, "First linebreak should be undestructed");
     int current_linebreak = 1;
     for(int i = 0; i <= program.size - 1; ++i) {
         bool is_linebreak = false;
@@ -2426,7 +5760,7 @@ void dump(char *dump_name) {
         if(is_linebreak) {
             log("[");
         }
-        log("%2x", program.data[i]);
+        log("%2x", get_program_byte(i));
         if(is_linebreak) {
             log("]");
         }
@@ -2434,7 +5768,7 @@ void dump(char *dump_name) {
     }
     log("\n%d linebreaks\n", program.linebreaks_count);
     for(int i = 0; i < program.linebreaks_count; ++i) {
-        log("%d,", program.linebreaks[i].location_);
+        log("%d,", get_linebreak_location(i));
     }
     log("\n");
 }
@@ -2442,6 +5776,9 @@ void dump_delta(char *title, Delta *delta) {
     log("\nDump delta %s\n", title);
     if(delta->type == Delta_InsertTokens) {
         log("Insert tokens\n-Cursor %d\n-At %d\n-Count %d\n", delta->cursor_was, delta->insert_data.at, delta->insert_data.count);
+    } else if(delta->type == Delta_ReplaceTokens) {
+        log("Replace tokens\n-Cursor %d\n-From %d bytes\n-To %d bytes\n-Gaps %d bytes\n", delta->cursor_was,
+            delta->replace_data.from_count, delta->replace_data.to_count, delta->replace_data.gaps_size);
     } else {
         log("Remove tokens\n-Cursor %d\n-At %d\n-Count %d\nData:\n", delta->cursor_was, delta->remove_data.at, delta->remove_data.count);
         u8 *data = cast(u8*)(delta + 1);